@@ -0,0 +1,75 @@
+#include "ClassAwareNms.h"
+
+#include <algorithm>
+
+
+void ClassAwareNms::Run(const DetectionCandidates& candidates, const float confidence_threshold, const float nms_threshold, std::vector<int>& keep)
+{
+	keep.clear();
+	order.clear();
+	right.resize(candidates.size());
+	bottom.resize(candidates.size());
+	area.resize(candidates.size());
+
+	const int* left = candidates.left.data();
+	const int* top = candidates.top.data();
+	const float* confidence = candidates.confidence.data();
+	const int* class_id = candidates.class_id.data();
+
+	for (int i = 0; i < (int)candidates.size(); ++i)
+	{
+		if (!(confidence[i] > confidence_threshold)) continue;
+		order.push_back(i);
+		right[i] = left[i] + candidates.width[i];
+		bottom[i] = top[i] + candidates.height[i];
+		area[i] = (double)candidates.width[i] * (double)candidates.height[i];
+	}
+
+	//Ties fall back to the candidate index, which is the order a stable sort by score leaves them in.
+	std::sort(order.begin(), order.end(), [&](const int a, const int b)
+	{
+		if (class_id[a] != class_id[b]) return class_id[a] < class_id[b];
+		if (confidence[a] != confidence[b]) return confidence[a] > confidence[b];
+		return a < b;
+	});
+
+	size_t class_begin = 0;
+	for (size_t n = 0; n < order.size(); ++n)
+	{
+		const int i = order[n];
+		if (n > 0 && class_id[i] != class_id[order[n - 1]]) class_begin = keep.size();
+
+		bool keep_it = true;
+		for (size_t k = class_begin; k < keep.size(); ++k)
+		{
+			const int j = keep[k];
+			if (area[i] + area[j] <= 0.0)
+			{
+				//NMSBoxes treats two empty boxes as identical.
+				if (nms_threshold < 1.f)
+				{
+					keep_it = false;
+					break;
+				}
+				continue;
+			}
+
+			const int inter_left = std::max(left[i], left[j]);
+			const int inter_right = std::min(right[i], right[j]);
+			if (inter_right <= inter_left) continue;
+			const int inter_top = std::max(top[i], top[j]);
+			const int inter_bottom = std::min(bottom[i], bottom[j]);
+			if (inter_bottom <= inter_top) continue;
+
+			//Same arithmetic as cv::jaccardDistance so the borderline cases agree with NMSBoxes.
+			double inter = (double)(inter_right - inter_left) * (double)(inter_bottom - inter_top);
+			float overlap = 1.f - (float)(1.0 - inter / (area[i] + area[j] - inter));
+			if (overlap > nms_threshold)
+			{
+				keep_it = false;
+				break;
+			}
+		}
+		if (keep_it) keep.push_back(i);
+	}
+}
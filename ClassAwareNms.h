@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+
+#include "DetectionCandidates.h"
+
+//Non maximum suppression for every class in one pass over the candidate arrays.
+//
+//Candidates are sorted once by class and then by descending confidence, which
+//lays each class out as a contiguous run. Each run is swept greedily against
+//the boxes already kept for that class. A cheap edge test rejects boxes that
+//cannot overlap before any IoU is computed. The survivors are the same ones
+//cv::dnn::NMSBoxes keeps per class, in the same order.
+//
+//All scratch space belongs to the object, so a long lived instance stops
+//allocating once it has seen its largest candidate set.
+class ClassAwareNms
+{
+public:
+	//Fills keep with indices into candidates, grouped by ascending class and
+	//within a class by descending confidence.
+	void Run(const DetectionCandidates& candidates, const float confidence_threshold, const float nms_threshold, std::vector<int>& keep);
+
+private:
+	std::vector<int> order;
+	std::vector<int> right;
+	std::vector<int> bottom;
+	std::vector<double> area;
+};
@@ -0,0 +1,72 @@
+#include "ClipRecorder.h"
+
+#include <algorithm>
+
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Util/Application.h>
+
+ClipRecorder::ClipRecorder(const Poco::Util::AbstractConfiguration& config) :
+	ThreadedDetectionProcessor("clips"),
+	log(Poco::Logger::get("clips"))
+{
+#ifdef OD_WITH_FFMPEG
+	Poco::Path directory(config.getString("clips.directory"));
+	if (directory.isRelative())
+	{
+		directory = Poco::Path(Poco::Util::Application::instance().config().getString("application.dir")).append(directory);
+	}
+	Poco::File(directory).createDirectories();
+
+	settings.directory = directory.toString();
+	settings.pre_us = (Poco::Timestamp::TimeDiff)(std::max(config.getDouble("clips.pre_seconds", 5.0), 0.0) * 1000000.0);
+	settings.post_us = (Poco::Timestamp::TimeDiff)(std::max(config.getDouble("clips.post_seconds", 10.0), 0.0) * 1000000.0);
+	settings.max_us = (Poco::Timestamp::TimeDiff)(std::max(config.getDouble("clips.max_seconds", 120.0), 1.0) * 1000000.0);
+	settings.rtsp_transport = config.getString("clips.rtsp_transport", "tcp");
+	log.information("Writing clips to " + settings.directory);
+#else
+	throw Poco::NotImplementedException("Clip recording needs a build with OD_WITH_FFMPEG defined");
+#endif
+}
+
+ClipRecorder::~ClipRecorder()
+{
+	stop();
+}
+
+void ClipRecorder::AddCamera(const std::string& src_name, const std::string& url)
+{
+#ifdef OD_WITH_FFMPEG
+	clippers[src_name] = new StreamClipper(src_name, url, settings);
+#endif
+}
+
+void ClipRecorder::start()
+{
+#ifdef OD_WITH_FFMPEG
+	for (auto& [name, clipper] : clippers) clipper->start();
+#endif
+	ThreadedDetectionProcessor::start();
+}
+
+void ClipRecorder::stop()
+{
+	ThreadedDetectionProcessor::stop();
+#ifdef OD_WITH_FFMPEG
+	//Open clips are finished off with whatever has been read so far.
+	for (auto& [name, clipper] : clippers) clipper->stop();
+#endif
+}
+
+void ClipRecorder::processDetection(std::vector<Detection>& detections)
+{
+#ifdef OD_WITH_FFMPEG
+	//A set of detections all come from one frame.
+	auto detection = std::find_if(detections.begin(), detections.end(), [](const Detection& d) { return !d.is_null; });
+	if (detection == detections.end()) return;
+
+	auto it = clippers.find(detection->src_name);
+	if (it != clippers.end()) it->second->Trigger(detection->frame_time);
+#endif
+}
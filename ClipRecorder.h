@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+
+#include <Poco/Logger.h>
+#include <Poco/SharedPtr.h>
+#include <Poco/Util/AbstractConfiguration.h>
+
+#include "Detection.h"
+#include "ThreadedDetectionProcessor.h"
+#ifdef OD_WITH_FFMPEG
+#include "StreamClipper.h"
+#endif
+
+//Records an MP4 clip of a camera around every detection it is sent, copied
+//straight out of the camera's stream by a StreamClipper per camera. Only
+//cameras with a url can be clipped.
+class ClipRecorder : public ThreadedDetectionProcessor
+{
+public:
+	//Reads clips.directory, clips.pre_seconds, clips.post_seconds, clips.max_seconds
+	//and clips.rtsp_transport. Throws when built without OD_WITH_FFMPEG.
+	ClipRecorder(const Poco::Util::AbstractConfiguration& config);
+	~ClipRecorder();
+
+	//Before start. The camera's stream is opened once the recorder starts.
+	void AddCamera(const std::string& src_name, const std::string& url);
+
+	void start();
+	void stop();
+
+protected:
+	void processDetection(std::vector<Detection>& detections) override;
+
+private:
+	Poco::Logger& log;
+#ifdef OD_WITH_FFMPEG
+	StreamClipper::Settings settings;
+	std::map<std::string, Poco::SharedPtr<StreamClipper>> clippers;
+#endif
+};
@@ -0,0 +1,258 @@
+#include "CpuBudget.h"
+
+#include <Poco/Exception.h>
+#include <Poco/NumberParser.h>
+#include <Poco/StringTokenizer.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+CpuBudget& CpuBudget::instance()
+{
+	static CpuBudget budget;
+	return budget;
+}
+
+CpuBudget::CpuBudget() :
+	log(Poco::Logger::get("CpuBudget")),
+	configured(false)
+{
+}
+
+std::vector<int> CpuBudget::ParseCoreList(const std::string& core_list)
+{
+	std::vector<int> cores;
+	Poco::StringTokenizer tokenizer(core_list, ",", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+	for (const auto& token : tokenizer)
+	{
+		size_t dash = token.find('-');
+		int first = Poco::NumberParser::parse(token.substr(0, dash));
+		int last = dash == std::string::npos ? first : Poco::NumberParser::parse(token.substr(dash + 1));
+		if (first < 0 || last < first) throw Poco::SyntaxException("Bad core range", token);
+		for (int core = first; core <= last; ++core) cores.push_back(core);
+	}
+	std::sort(cores.begin(), cores.end());
+	cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+	return cores;
+}
+
+std::string CpuBudget::FormatCoreList(const std::vector<int>& cores)
+{
+	std::string formatted;
+	for (size_t i = 0; i < cores.size(); )
+	{
+		size_t j = i;
+		while (j + 1 < cores.size() && cores[j + 1] == cores[j] + 1) ++j;
+		if (!formatted.empty()) formatted += ",";
+		formatted += std::to_string(cores[i]);
+		if (j > i) formatted += "-" + std::to_string(cores[j]);
+		i = j + 1;
+	}
+	return formatted;
+}
+
+std::vector<int> CpuBudget::AvailableCores()
+{
+	std::vector<int> cores;
+#ifdef _WIN32
+	DWORD_PTR process_mask = 0;
+	DWORD_PTR system_mask = 0;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+	{
+		for (int core = 0; core < (int)(sizeof(DWORD_PTR) * 8); ++core)
+		{
+			if (process_mask & ((DWORD_PTR)1 << core)) cores.push_back(core);
+		}
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for (int core = 0; core < CPU_SETSIZE; ++core)
+		{
+			if (CPU_ISSET(core, &set)) cores.push_back(core);
+		}
+	}
+#endif
+	if (cores.empty())
+	{
+		for (int core = 0; core < (int)std::max(std::thread::hardware_concurrency(), 1u); ++core) cores.push_back(core);
+	}
+	return cores;
+}
+
+//Core to NUMA node. Empty on single node hosts and where it cannot be found out.
+std::map<int, int> CpuBudget::CoreNodes()
+{
+	std::map<int, int> nodes;
+#ifdef _WIN32
+	ULONG highest_node = 0;
+	if (GetNumaHighestNodeNumber(&highest_node) && highest_node > 0)
+	{
+		for (ULONG node = 0; node <= highest_node; ++node)
+		{
+			ULONGLONG mask = 0;
+			if (!GetNumaNodeProcessorMask((UCHAR)node, &mask)) continue;
+			for (int core = 0; core < 64; ++core)
+			{
+				if (mask & (1ULL << core)) nodes[core] = (int)node;
+			}
+		}
+	}
+#elif defined(__linux__)
+	for (int node = 0; ; ++node)
+	{
+		std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		if (!cpulist.is_open()) break;
+		std::string line;
+		std::getline(cpulist, line);
+		for (int core : ParseCoreList(line)) nodes[core] = node;
+	}
+	if (std::all_of(nodes.begin(), nodes.end(), [](const std::pair<const int, int>& core) { return core.second == 0; })) nodes.clear();
+#endif
+	return nodes;
+}
+
+bool CpuBudget::PinCurrentThread(const std::vector<int>& cores)
+{
+	if (cores.empty()) return false;
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (int core : cores)
+	{
+		if (core < (int)(sizeof(DWORD_PTR) * 8)) mask |= (DWORD_PTR)1 << core;
+	}
+	return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int core : cores)
+	{
+		if (core < CPU_SETSIZE) CPU_SET(core, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+bool CpuBudget::PinProcess(const std::vector<int>& cores)
+{
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (int core : cores)
+	{
+		if (core < (int)(sizeof(DWORD_PTR) * 8)) mask |= (DWORD_PTR)1 << core;
+	}
+	return mask != 0 && SetProcessAffinityMask(GetCurrentProcess(), mask) != 0;
+#else
+	//Threads inherit the affinity of the thread that creates them.
+	return PinCurrentThread(cores);
+#endif
+}
+
+void CpuBudget::Configure(const Poco::Util::AbstractConfiguration& config)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_budget);
+	const std::vector<int> available = AvailableCores();
+	std::vector<int> cores = config.has("cpu.cores") ? ParseCoreList(config.getString("cpu.cores")) : available;
+	cores.erase(std::remove_if(cores.begin(), cores.end(),
+		[&](int core) { return std::find(available.begin(), available.end(), core) == available.end(); }), cores.end());
+	if (cores.empty()) throw Poco::InvalidArgumentException("cpu.cores names no core this process may use");
+
+	auto within_budget = [&](std::vector<int> subset)
+	{
+		subset.erase(std::remove_if(subset.begin(), subset.end(),
+			[&](int core) { return std::find(cores.begin(), cores.end(), core) == cores.end(); }), subset.end());
+		return subset;
+	};
+	decoder_cores = within_budget(ParseCoreList(config.getString("cpu.decoder_cores", "")));
+	if (config.has("cpu.detector_cores"))
+	{
+		detector_cores = within_budget(ParseCoreList(config.getString("cpu.detector_cores")));
+	}
+	else
+	{
+		detector_cores.clear();
+		std::copy_if(cores.begin(), cores.end(), std::back_inserter(detector_cores),
+			[&](int core) { return std::find(decoder_cores.begin(), decoder_cores.end(), core) == decoder_cores.end(); });
+	}
+	if (detector_cores.empty()) detector_cores = cores;
+
+	//Grouped by node, so slicing in order keeps each slice on as few nodes as possible.
+	const std::map<int, int> nodes = CoreNodes();
+	std::stable_sort(detector_cores.begin(), detector_cores.end(), [&](int a, int b)
+	{
+		auto node_a = nodes.find(a);
+		auto node_b = nodes.find(b);
+		return (node_a == nodes.end() ? 0 : node_a->second) < (node_b == nodes.end() ? 0 : node_b->second);
+	});
+
+	const size_t workers = (size_t)std::max(config.getInt("detector.workers", 1), 1);
+	worker_slices.assign(workers, std::vector<int>());
+	const bool pin_workers = config.getBool("cpu.pin_workers", false) && workers <= detector_cores.size();
+	for (size_t w = 0; w < workers; ++w)
+	{
+		if (!pin_workers)
+		{
+			worker_slices[w] = detector_cores;
+			continue;
+		}
+		size_t first = w * detector_cores.size() / workers;
+		size_t last = (w + 1) * detector_cores.size() / workers;
+		worker_slices[w].assign(detector_cores.begin() + first, detector_cores.begin() + last);
+		std::sort(worker_slices[w].begin(), worker_slices[w].end());
+	}
+	std::sort(detector_cores.begin(), detector_cores.end());
+
+	//OpenCV's pool is shared by every worker, so by default it is sized so the
+	//workers together fill the detector cores rather than each taking them all.
+	int opencv_threads = config.getInt("cpu.opencv_threads", 0);
+	if (opencv_threads <= 0) opencv_threads = std::max((int)(detector_cores.size() / workers), 1);
+
+	PinProcess(cores);
+	cv::setNumThreads(opencv_threads);
+	//The pool threads are created on first use and, outside Windows, inherit the
+	//affinity of whichever thread gets there first. Make that a thread on the
+	//detector cores rather than a worker pinned to its own slice.
+	PinCurrentThread(detector_cores);
+	cv::parallel_for_(cv::Range(0, opencv_threads), [](const cv::Range&) {});
+	PinCurrentThread(cores);
+	configured = true;
+
+	log.information("Cores " + FormatCoreList(cores) + ": detector " + FormatCoreList(detector_cores) +
+		(decoder_cores.empty() ? "" : ", decoders " + FormatCoreList(decoder_cores)) +
+		", " + std::to_string(opencv_threads) + " OpenCV thread(s)" + (pin_workers ? ", workers pinned" : "") +
+		(nodes.empty() ? "" : ", detector cores ordered by NUMA node"));
+}
+
+void CpuBudget::PinDetectorWorker(const size_t worker_index)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_budget);
+	if (!configured || worker_slices.empty()) return;
+	const std::vector<int>& slice = worker_slices[worker_index % worker_slices.size()];
+	if (!PinCurrentThread(slice)) log.warning("Could not pin detector worker " + std::to_string(worker_index));
+	else if (slice.size() < detector_cores.size()) log.debug("Detector worker " + std::to_string(worker_index) + " on cores " + FormatCoreList(slice));
+}
+
+void CpuBudget::PinDecoder()
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_budget);
+	if (!configured || decoder_cores.empty()) return;
+	if (!PinCurrentThread(decoder_cores)) log.warning("Could not pin decoder thread");
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+
+#include <Poco/Logger.h>
+#include <Poco/Mutex.h>
+#include <Poco/Util/AbstractConfiguration.h>
+
+//Decides which cores each kind of thread may run on and how many threads
+//OpenCV's parallel_for pool gets. Detector workers run on the detector cores,
+//each on its own slice of them with cpu.pin_workers, and frame decoding runs
+//on the decoder cores so the two stop evicting each other's caches. On a
+//multi-socket host the detector cores are sliced node by node so no worker
+//straddles a NUMA node.
+//
+//Threads pin themselves by role when they start. Until Configure is called,
+//or where the platform has no affinity support, nothing is pinned.
+class CpuBudget
+{
+public:
+	static CpuBudget& instance();
+
+	//Reads the cpu.* keys and detector.workers, restricts the process to
+	//cpu.cores and sizes OpenCV's thread pool. Call before any other threads start.
+	void Configure(const Poco::Util::AbstractConfiguration& config);
+
+	void PinDetectorWorker(const size_t worker_index);
+	void PinDecoder();
+
+	//"0-3,8,10-11"
+	static std::vector<int> ParseCoreList(const std::string& core_list);
+	static std::string FormatCoreList(const std::vector<int>& cores);
+
+private:
+	CpuBudget();
+
+	Poco::Logger& log;
+	Poco::Mutex mu_budget;
+	bool configured;
+	std::vector<int> detector_cores;
+	std::vector<int> decoder_cores;
+	std::vector<std::vector<int>> worker_slices;
+
+	static std::vector<int> AvailableCores();
+	static std::map<int, int> CoreNodes();
+	static bool PinCurrentThread(const std::vector<int>& cores);
+	static bool PinProcess(const std::vector<int>& cores);
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <opencv2/opencv.hpp>
+#include <Poco/Timestamp.h>
 
 #include <string>
 #include <vector>
@@ -15,6 +16,8 @@ public:
 	inline int centerX() const { return bounding_box.x + bounding_box.width / 2; }
 	inline int centerY() const { return bounding_box.y + bounding_box.height / 2; }
 	cv::Mat frame;
+	//When the frame was read from its source.
+	Poco::Timestamp frame_time;
 	std::string src_name;
 	std::string Name() { return src_name + "." + detection_class; }
 	bool is_null = true;
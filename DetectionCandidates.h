@@ -0,0 +1,73 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+//Boxes that passed the confidence threshold, kept as parallel arrays so the
+//decode and NMS passes stream through them. clear() keeps the capacity, so a
+//buffer reused from frame to frame stops allocating once it has grown.
+struct DetectionCandidates
+{
+	std::vector<int> left;
+	std::vector<int> top;
+	std::vector<int> width;
+	std::vector<int> height;
+	std::vector<float> confidence;
+	std::vector<int> class_id;
+
+	inline std::size_t size() const { return confidence.size(); }
+	inline bool empty() const { return confidence.empty(); }
+
+	inline void push_back(const int l, const int t, const int w, const int h, const float conf, const int cls)
+	{
+		left.push_back(l);
+		top.push_back(t);
+		width.push_back(w);
+		height.push_back(h);
+		confidence.push_back(conf);
+		class_id.push_back(cls);
+	}
+
+	inline void clear()
+	{
+		left.clear();
+		top.clear();
+		width.clear();
+		height.clear();
+		confidence.clear();
+		class_id.clear();
+	}
+
+	//Keeps, in order, only the candidates keep(index) accepts. Nothing is reallocated.
+	template <typename Keep>
+	inline void filter(Keep keep)
+	{
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < size(); ++i)
+		{
+			if (!keep(i)) continue;
+			left[kept] = left[i];
+			top[kept] = top[i];
+			width[kept] = width[i];
+			height[kept] = height[i];
+			confidence[kept] = confidence[i];
+			class_id[kept] = class_id[i];
+			++kept;
+		}
+		left.resize(kept);
+		top.resize(kept);
+		width.resize(kept);
+		height.resize(kept);
+		confidence.resize(kept);
+		class_id.resize(kept);
+	}
+
+	inline void reserve(const std::size_t n)
+	{
+		left.reserve(n);
+		top.reserve(n);
+		width.reserve(n);
+		height.reserve(n);
+		confidence.reserve(n);
+		class_id.reserve(n);
+	}
+};
@@ -0,0 +1,62 @@
+#include "DetectionMask.h"
+
+#include <Poco/Exception.h>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+static const int max_grid_size = 256;
+
+DetectionMask::DetectionMask(const std::string& image_path, const float min_overlap) :
+	min_overlap(min_overlap)
+{
+	cv::Mat image = cv::imread(image_path, cv::IMREAD_GRAYSCALE);
+	if (image.empty())
+	{
+		throw Poco::FileNotFoundException("Unable to load mask image " + image_path);
+	}
+
+	double scale = std::min(1.0, (double)max_grid_size / std::max(image.cols, image.rows));
+	grid = cv::Size(std::max((int)std::lround(image.cols * scale), 1), std::max((int)std::lround(image.rows * scale), 1));
+
+	cv::Mat small_mask;
+	cv::resize(image, small_mask, grid, 0, 0, cv::INTER_AREA);
+	cv::threshold(small_mask, small_mask, 127, 1, cv::THRESH_BINARY);
+	cv::integral(small_mask, sums, CV_32S);
+
+	white_bounds = cv::boundingRect(small_mask);
+	if (white_bounds.empty())
+	{
+		throw Poco::InvalidArgumentException("Mask image " + image_path + " has no white area to watch");
+	}
+}
+
+float DetectionMask::Coverage(const cv::Rect& region, const cv::Size frame_size) const
+{
+	if (region.width <= 0 || region.height <= 0 || frame_size.width <= 0 || frame_size.height <= 0) return 0.0f;
+
+	const double sx = (double)grid.width / frame_size.width;
+	const double sy = (double)grid.height / frame_size.height;
+	int x0 = std::min(std::max((int)std::floor(region.x * sx), 0), grid.width);
+	int y0 = std::min(std::max((int)std::floor(region.y * sy), 0), grid.height);
+	int x1 = std::min(std::max((int)std::ceil((region.x + region.width) * sx), 0), grid.width);
+	int y1 = std::min(std::max((int)std::ceil((region.y + region.height) * sy), 0), grid.height);
+	if (x1 <= x0 || y1 <= y0) return 0.0f;
+
+	int white = sums.at<int>(y1, x1) - sums.at<int>(y0, x1) - sums.at<int>(y1, x0) + sums.at<int>(y0, x0);
+	return (float)white / (float)((x1 - x0) * (y1 - y0));
+}
+
+cv::Rect DetectionMask::Bounds(const cv::Size frame_size) const
+{
+	const double sx = (double)frame_size.width / grid.width;
+	const double sy = (double)frame_size.height / grid.height;
+	int x0 = (int)std::floor(white_bounds.x * sx);
+	int y0 = (int)std::floor(white_bounds.y * sy);
+	int x1 = (int)std::ceil((white_bounds.x + white_bounds.width) * sx);
+	int y1 = (int)std::ceil((white_bounds.y + white_bounds.height) * sy);
+	return cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(cv::Point(0, 0), frame_size);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <Poco/RefCountedObject.h>
+
+//A black and white image marking where detections count. White is watched,
+//black is ignored. The image is loaded once, shrunk to a coarse bitmask and
+//kept as an integral image, so the share of any box that falls on white is
+//four lookups no matter how big the box is. Boxes are given in frame pixels
+//and the mask stretches to whatever size the frames are.
+class DetectionMask : public Poco::RefCountedObject
+{
+public:
+	DetectionMask(const std::string& image_path, const float min_overlap);
+
+	//Fraction (0-1) of region that lies on the white part of the mask.
+	float Coverage(const cv::Rect& region, const cv::Size frame_size) const;
+
+	//True when enough of the box is on white for the detection to be kept.
+	inline bool Accepts(const cv::Rect& box, const cv::Size frame_size) const { return Coverage(box, frame_size) >= min_overlap; }
+
+	//True when region touches the white part at all.
+	inline bool Touches(const cv::Rect& region, const cv::Size frame_size) const { return Coverage(region, frame_size) > 0.0f; }
+
+	//Smallest frame rectangle holding all of the white part.
+	cv::Rect Bounds(const cv::Size frame_size) const;
+
+private:
+	cv::Mat sums;
+	cv::Size grid;
+	cv::Rect white_bounds;
+	float min_overlap;
+};
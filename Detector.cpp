@@ -1,4 +1,9 @@
 #include "Detector.h"
+#include "YoloDecoder.h"
+#include "ClassAwareNms.h"
+#include "FramePreprocessor.h"
+#include "DnnNames.h"
+#include "CpuBudget.h"
 
 #include <Poco/Path.h>
 #include <Poco/Exception.h>
@@ -11,95 +16,270 @@
 #include <opencv2/videoio.hpp>
 
 #include <fstream>
+#include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <set>
 
 
 Detector::Detector(const Poco::Util::AbstractConfiguration& config) :
-	want_to_stop(false)
+	want_to_stop(false),
+	log(Poco::Logger::get("Detector")),
+	model_registry(Poco::Path(config.getString("application.dir")).append("yolo-coco").toString()),
+	job_id_counter(0),
+	frame_bytes_held(0),
+	peak_frame_bytes(0),
+	batch_count(0),
+	batched_jobs(0),
+	busy_us(0),
+	workers_warming(0),
+	ev_ready(Poco::Event::EVENT_MANUALRESET)
 {
-	
+	Poco::Timestamp startup_timer;
+	default_config_name = config.getString("detector.config", "yolov4-leaky-416.cfg");
+	default_weights_name = config.getString("detector.weights", "yolov4-leaky-416.weights");
+	default_names_name = config.getString("detector.coco_names", "coco.names");
+	//Batching needs every frame resized to the same input so this must always be set.
+	default_analysis_size = config.getInt("detector.analysis_size", 416);
+	default_output_layout = config.getString("detector.output", "");
+	default_model = model_registry.Resolve(default_config_name, default_weights_name, default_names_name, default_analysis_size, default_output_layout);
+
+	engine_name = Poco::toLower(config.getString("detector.engine", "opencv"));
+	engine_options.backend_name = Poco::toLower(config.getString("detector.backend", ""));
+	engine_options.target_name = Poco::toLower(config.getString("detector.target", ""));
+	engine_options.threads = std::max(config.getInt("detector.engine_threads", 0), 0);
+
+	use_letterbox = config.getBool("detector.letterbox", false);
+
+	batch_size = (size_t)std::max(config.getInt("detector.batch_size", 1), 1);
+	batch_wait_ms = std::max(config.getInt("detector.batch_wait_ms", 0), 0);
+
+	std::string policy = Poco::toLower(config.getString("detector.queue_policy", "drop_oldest"));
+	if (policy == "reject") queue_policy = QueuePolicy::Reject;
+	else if (policy == "drop_oldest") queue_policy = QueuePolicy::DropOldest;
+	else if (policy == "keep_latest") queue_policy = QueuePolicy::KeepLatest;
+	else throw Poco::InvalidArgumentException("detector.queue_policy", policy);
+	queue_capacity = (size_t)std::max(config.getInt("detector.queue_capacity", 64), 1);
+	frame_memory_budget = (size_t)std::max(config.getInt("detector.frame_memory_mb", 1024), 1) * 1024 * 1024;
+
+	warmup_runs = std::max(config.getInt("detector.warmup_runs", 2), 0);
+
+	result_capacity = (size_t)std::max(config.getInt("detector.result_capacity", 256), 1);
+	result_ttl_us = (Poco::Timestamp::TimeDiff)std::max(config.getInt("detector.result_ttl_ms", 60000), 0) * 1000;
+
+	use_low_priority = (StrToBackend(engine_options.backend_name) == cv::dnn::DNN_BACKEND_DEFAULT &&
+		StrToTarget(engine_options.target_name) == cv::dnn::DNN_TARGET_CPU);
+	use_low_priority = config.getBool("detector.low_priority", use_low_priority);
+
+	//The default model is loaded up front so a broken install fails at startup.
+	//Models only some cameras use are loaded when their first job arrives.
+	int worker_count = std::max(config.getInt("detector.workers", 1), 1);
+	for (int i = 0; i < worker_count; ++i)
+	{
+		Poco::SharedPtr<Worker> worker = new Worker;
+		worker->index = (size_t)i;
+		GetEngine(*worker, *default_model);
+		worker->thread.setName("Detector " + std::to_string(i));
+		workers.push_back(worker);
+	}
+	log.information("Loaded " + std::to_string(workers.size()) + " detector worker(s) in " + std::to_string(startup_timer.elapsed() / 1000) + " ms");
+}
 
-	Poco::Path yolo_config_path(config.getString("application.dir"));
-	yolo_config_path.append("yolo-coco");
-	Poco::Path yolo_weight_path(yolo_config_path);
-	Poco::Path coco_names_path(yolo_config_path);
-	yolo_config_path.append(config.getString("detector.config", "yolov4-leaky-416.cfg"));
-	yolo_weight_path.append(config.getString("detector.weights",  "yolov4-leaky-416.weights"));
-	coco_names_path.append(config.getString("detector.coco_names", "coco.names"));
+InferenceEngine& Detector::GetEngine(Worker& worker, const ModelSpec& model)
+{
+	auto it = worker.engines.find(model.NetworkKey());
+	if (it != worker.engines.end()) return *it->second;
 
-	std::ifstream ifs(coco_names_path.toString().c_str());
-	if (!ifs.is_open())
+	//Not every runtime loads every format, a Darknet model on onnxruntime for one.
+	Poco::SharedPtr<InferenceEngine> engine;
+	try
 	{
-		throw new Poco::RuntimeException("Unable to open " + coco_names_path.toString());
+		engine = InferenceEngine::Create(engine_name, model, engine_options);
 	}
-		
-	std::string line;
-	while (std::getline(ifs, line))
+	catch (Poco::InvalidArgumentException& e)
 	{
-		classes.push_back(line);
+		if (engine_name == "opencv") throw;
+		log.warning(e.displayText() + ", using opencv");
+		engine = InferenceEngine::Create("opencv", model, engine_options);
 	}
+	log.information("Worker " + std::to_string(worker.index) + " runs " + Poco::Path(model.weights_file).getFileName() + " on " + engine->Name());
+	worker.engines[model.NetworkKey()] = engine;
+	return *engine;
+}
+
+Poco::SharedPtr<const ModelSpec> Detector::ResolveModel(const Poco::Util::AbstractConfiguration& camera_config)
+{
+	return ResolveModel(camera_config, camera_config.getInt("yolo.analysis_size", default_analysis_size));
+}
+
+Poco::SharedPtr<const ModelSpec> Detector::ResolveModel(const Poco::Util::AbstractConfiguration& camera_config, const int analysis_size)
+{
+	return model_registry.Resolve(
+		camera_config.getString("yolo.config", default_config_name),
+		camera_config.getString("yolo.weights", default_weights_name),
+		camera_config.getString("yolo.coco_names", default_names_name),
+		analysis_size,
+		camera_config.getString("yolo.output", default_output_layout));
+}
 
-	std::string bkend = Poco::toLower(config.getString("detector.backend", ""));
-	std::string target = Poco::toLower(config.getString("detector.target", ""));
+Detector::~Detector()
+{
+}
 
-	yolo_net = cv::dnn::readNetFromDarknet(yolo_config_path.toString(), yolo_weight_path.toString());
-	if (!bkend.empty()) yolo_net.setPreferableBackend(StrToBackend(bkend));
-	if (!target.empty()) yolo_net.setPreferableTarget(StrToTarget(target));
-	output_layers = yolo_net.getUnconnectedOutLayersNames();
 
-	if (config.has("detector.analysis_size"))
+Detector::Submission Detector::SubmitDetectionJob(const cv::Mat frame, const Poco::Timestamp& captured, const std::string src_name, const float confidence_threshold, const float nms_threshold,
+	CompletionHandler on_complete)
+{
+	Submission submission = { Submission::Status::Queued, ++job_id_counter };
+	DetectionJob job = { submission.job_id, frame, captured, src_name, confidence_threshold, nms_threshold, on_complete };
+	job.frame_bytes = frame.total() * frame.elemSize();
+	PlanJob(job);
+
+	std::vector<DetectionJob> superseded;
+	std::vector<DetectionJob> dropped;
 	{
-		auto asize = config.getInt("yolo.analysis_size", 416);
-		analysis_size = cv::Size(asize, asize);
-	}
+		Poco::ScopedLock<Poco::Mutex> locker(mu_scheduler);
+		DetectionJob victim = {};
+		//Running jobs hold frame memory that dropping queued jobs cannot free. When
+		//even an empty queue would leave no room the job is turned away before
+		//anything is dropped, so the source keeps whatever it already had queued.
+		const size_t queued_bytes = scheduler.Sum([](const DetectionJob& queued) { return queued.frame_bytes; });
+		const bool can_make_room = queue_policy != QueuePolicy::Reject &&
+			frame_bytes_held - queued_bytes + job.frame_bytes <= frame_memory_budget;
+		if (queue_policy == QueuePolicy::KeepLatest && can_make_room)
+		{
+			while (scheduler.DropOldest(src_name, victim)) dropped.push_back(victim);
+		}
 
-	use_low_priority = (StrToBackend(bkend) == cv::dnn::DNN_BACKEND_DEFAULT &&
-		StrToTarget(target) == cv::dnn::DNN_TARGET_CPU);
-	use_low_priority = config.getBool("detector.low_priority", use_low_priority);
+		//Bytes of jobs dropped here are only released from frame_bytes_held once they are reported.
+		size_t releasing = 0;
+		for (const auto& d : dropped) releasing += d.frame_bytes;
+		while (scheduler.size() >= queue_capacity || frame_bytes_held - releasing + job.frame_bytes > frame_memory_budget)
+		{
+			if (!can_make_room ||
+				!(scheduler.DropOldest(src_name, victim) || scheduler.DropOldest("", victim)))
+			{
+				submission.status = Submission::Status::Rejected;
+				scheduler.CountRejected(src_name);
+				break;
+			}
+			dropped.push_back(victim);
+			releasing += victim.frame_bytes;
+		}
+
+		if (submission.status != Submission::Status::Rejected)
+		{
+			if (!dropped.empty()) submission.status = Submission::Status::QueuedAfterDropping;
+			frame_bytes_held += job.frame_bytes;
+			peak_frame_bytes = std::max(peak_frame_bytes, frame_bytes_held - releasing);
+			scheduler.Push(src_name, job, (double)std::max(job.tiles.size(), (size_t)1), superseded);
+			job_queued.broadcast();
+		}
+	}
+	ReportUnrun(superseded, DetectionResult::Status::Superseded);
+	ReportUnrun(dropped, DetectionResult::Status::Dropped);
+	return submission;
 }
 
-Detector::~Detector()
+bool Detector::CancelDetectionJob(const uint64_t job_id)
 {
+	std::vector<DetectionJob> cancelled(1);
+	{
+		Poco::ScopedLock<Poco::Mutex> locker(mu_scheduler);
+		if (!scheduler.Cancel(job_id, cancelled.front())) return false;
+	}
+	ReportUnrun(cancelled, DetectionResult::Status::Cancelled);
+	return true;
 }
 
-int Detector::StrToTarget(const std::string& target)
+bool Detector::IsDetectionJobOverdue(const uint64_t job_id)
 {
-	using namespace cv::dnn;
-	if (target == "cuda") return DNN_TARGET_CUDA;
-	if (target == "cuda_fp16") return DNN_TARGET_CUDA_FP16;
-	if (target == "opencl") return DNN_TARGET_OPENCL;
-	if (target == "opencl_fp16") return DNN_TARGET_CUDA_FP16;
-	if (target == "myriad") return DNN_TARGET_MYRIAD;
-	if (target == "vulkan") return DNN_TARGET_VULKAN;
-	if (target == "fpga") return DNN_TARGET_FPGA;
-	if (target == "cpu") return DNN_TARGET_CPU;
-
-	return DNN_TARGET_CPU;
+	Poco::ScopedLock<Poco::Mutex> locker(mu_scheduler);
+	return scheduler.IsOverdue(job_id);
 }
 
+std::map<std::string, SourceQueueStats> Detector::GetQueueStats()
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_scheduler);
+	return scheduler.Stats();
+}
 
-
-int Detector::StrToBackend(const std::string& bkend)
+//Called without mu_scheduler held since the handlers may submit again.
+void Detector::ReportUnrun(std::vector<DetectionJob>& jobs, const DetectionResult::Status status)
 {
-	using namespace cv::dnn;
-	if (bkend == "cuda") return DNN_BACKEND_CUDA;
-	if (bkend == "halide") return DNN_BACKEND_HALIDE;
-	if (bkend == "intel_inference") return DNN_BACKEND_INFERENCE_ENGINE;
-	if (bkend == "opencv") return DNN_BACKEND_OPENCV;
-	if (bkend == "vkcom") return DNN_BACKEND_VKCOM;
-	if (bkend == "default") return DNN_BACKEND_DEFAULT;
-	return cv::dnn::DNN_BACKEND_DEFAULT;
+	for (auto& job : jobs)
+	{
+		DetectionResult result;
+		result.detection_time_us = 0;
+		result.status = status;
+		CompleteJob(job, result);
+	}
 }
 
+void Detector::PlanJob(DetectionJob& job)
+{
+	const cv::Size frame_size = job.frame.size();
+	job.model = default_model;
+	Poco::ScopedLock<Poco::Mutex> locker(mu_source_profiles);
+	auto histograms = source_histograms.find(job.src_name);
+	if (histograms == source_histograms.end())
+	{
+		Metrics& metrics = Metrics::instance();
+		StageHistograms stage_histograms =
+		{
+			&metrics.Histogram("od_queue_wait_seconds", "Time frames wait for a detector worker", "camera", job.src_name),
+			&metrics.Histogram("od_preprocess_seconds", "Time spent resizing frames into the network input, per batch", "camera", job.src_name),
+			&metrics.Histogram("od_forward_seconds", "Time spent running the network, per batch", "camera", job.src_name),
+			&metrics.Histogram("od_decode_seconds", "Time spent decoding network output into candidate boxes", "camera", job.src_name),
+			&metrics.Histogram("od_nms_seconds", "Time spent merging overlapping candidate boxes", "camera", job.src_name)
+		};
+		histograms = source_histograms.emplace(job.src_name, stage_histograms).first;
+	}
+	job.histograms = &histograms->second;
+	auto it = source_profiles.find(job.src_name);
+	if (it == source_profiles.end())
+	{
+		job.tiles.push_back(cv::Rect(cv::Point(0, 0), frame_size));
+		return;
+	}
+
+	const SourceProfile& profile = it->second;
+	if (!profile.model.isNull()) job.model = profile.model;
+	profile.tiling.Plan(frame_size, job.tiles);
+	job.mask = profile.mask;
+	if (job.mask.isNull()) return;
 
-uint64_t Detector::SubmitDetectionJob(const cv::Mat frame, const std::string src_name, const float confidence_threshold, const float nms_threshold)
+	//Whatever the mask blacks out entirely is never preprocessed or run. An untiled
+	//frame is only cropped when a region of interest was asked for.
+	if (profile.tiling.IsTiled())
+	{
+		job.tiles.erase(std::remove_if(job.tiles.begin(), job.tiles.end(),
+			[&](const cv::Rect& tile) { return !job.mask->Touches(tile, frame_size); }), job.tiles.end());
+	}
+	else if (!profile.tiling.roi.empty())
+	{
+		cv::Rect cropped = job.tiles.front() & job.mask->Bounds(frame_size);
+		job.tiles.clear();
+		if (!cropped.empty()) job.tiles.push_back(cropped);
+	}
+}
+
+void Detector::ConfigureSource(const std::string& src_name, const SourceProfile& profile)
 {
-	Poco::ScopedLock<Poco::Mutex> locker(mu_job_queue);
-	uint64_t job_id = ++job_id_counter;
-	DetectionJob job = { job_id, frame, src_name, confidence_threshold, nms_threshold };
-	job_queue.push(job);
-	ev_job_queue.set();
-	return job_id;
+	{
+		Poco::ScopedLock<Poco::Mutex> locker(mu_scheduler);
+		scheduler.ConfigureSource(src_name, profile.priority, profile.weight, profile.deadline_us);
+	}
+	Poco::ScopedLock<Poco::Mutex> locker(mu_source_profiles);
+	source_profiles[src_name] = profile;
+	if (!profile.model.isNull() && profile.model != default_model)
+	{
+		log.information(src_name + " runs " + Poco::Path(profile.model->weights_file).getFileName() + " at " + std::to_string(profile.model->input_size.width));
+	}
+	if (profile.tiling.IsTiled())
+	{
+		log.information(src_name + " runs as " + std::to_string(profile.tiling.columns) + "x" + std::to_string(profile.tiling.rows) + " tiles");
+	}
 }
 
 std::optional<Detector::DetectionResult> Detector::GetDetectionJobIfComplete(const uint64_t job_id)
@@ -108,140 +288,428 @@ std::optional<Detector::DetectionResult> Detector::GetDetectionJobIfComplete(con
 	auto it = job_output_map.find(job_id);
 	if (it != job_output_map.end())
 	{
-		return it->second;
+		std::optional<DetectionResult> result(std::move(it->second.result));
+		job_output_map.erase(it);
+		return result;
 	}
 	return std::optional<DetectionResult>();
 }
 
+void Detector::CompleteJob(DetectionJob& job, DetectionResult& result)
+{
+	//Drop our reference to the frame now rather than whenever the job goes out of scope.
+	job.frame.release();
+	frame_bytes_held -= job.frame_bytes;
+
+	if (job.on_complete)
+	{
+		job.on_complete(job.job_id, result);
+		return;
+	}
+
+	Poco::ScopedLock<Poco::Mutex> locker(mu_job_output_map);
+	for (auto it = job_output_map.begin(); it != job_output_map.end(); )
+	{
+		if (it->second.completed.isElapsed(result_ttl_us)) it = job_output_map.erase(it);
+		else ++it;
+	}
+	while (!job_output_map.empty() && job_output_map.size() >= result_capacity)
+	{
+		log.warning("Discarding uncollected detection result " + std::to_string(job_output_map.begin()->first));
+		job_output_map.erase(job_output_map.begin());
+	}
+	StoredResult& stored = job_output_map[job.job_id];
+	stored.result = std::move(result);
+	stored.completed.update();
+}
+
 
 void Detector::start()
 {
 	want_to_stop = false;
-	job_thread.start(*this);
+	start_time.update();
+	PlanWarmup();
+	ev_ready.reset();
+	workers_warming = workers.size();
+	for (auto& worker : workers)
+	{
+		worker->thread.start(*this);
+	}
+}
+
+bool Detector::WaitUntilReady(const long timeout_ms)
+{
+	return ev_ready.tryWait(timeout_ms);
+}
+
+//Each model at a batch of one, at the full batch size and at the tile count of
+//every tiled source using it. Sources configured after start() are not warmed.
+void Detector::PlanWarmup()
+{
+	std::map<std::string, std::pair<Poco::SharedPtr<const ModelSpec>, std::set<int>>> shapes;
+	auto add = [&](const Poco::SharedPtr<const ModelSpec>& model, const int batch)
+	{
+		auto& shape = shapes[model->key];
+		shape.first = model;
+		shape.second.insert(batch);
+	};
+
+	add(default_model, 1);
+	add(default_model, (int)batch_size);
+	{
+		Poco::ScopedLock<Poco::Mutex> locker(mu_source_profiles);
+		for (const auto& [src_name, profile] : source_profiles)
+		{
+			std::vector<Poco::SharedPtr<const ModelSpec>> models = profile.alternate_models;
+			models.push_back(profile.model.isNull() ? default_model : profile.model);
+			for (const auto& model : models)
+			{
+				add(model, 1);
+				add(model, (int)batch_size);
+				if (profile.tiling.IsTiled()) add(model, profile.tiling.columns * profile.tiling.rows);
+			}
+		}
+	}
+
+	warmup_plan.clear();
+	if (warmup_runs == 0) return;
+	for (const auto& [key, shape] : shapes)
+	{
+		for (int batch : shape.second)
+		{
+			WarmupShape warmup = { shape.first, batch };
+			warmup_plan.push_back(warmup);
+		}
+	}
+}
+
+void Detector::Warmup(Worker& worker)
+{
+	for (const auto& warmup : warmup_plan)
+	{
+		if (want_to_stop) break;
+		const ModelSpec& model = *warmup.model;
+		try
+		{
+			InferenceEngine& engine = GetEngine(worker, model);
+			cv::Mat blob = FramePreprocessor::PrepareBlob(worker.input_storage, warmup.batch, model.input_size);
+			blob.setTo(cv::Scalar(0.5));
+			std::vector<cv::Mat> outputs;
+			int64_t cold_us = 0;
+			int64_t warm_us = 0;
+			for (int run = 0; run < warmup_runs; ++run)
+			{
+				Poco::Timestamp timer;
+				engine.Forward(blob, outputs);
+				(run == 0 ? cold_us : warm_us) = timer.elapsed();
+			}
+
+			std::stringstream msg;
+			msg << "Worker " << worker.index << " warmed " << Poco::Path(model.weights_file).getFileName() << " at " << model.input_size.width
+				<< " x" << warmup.batch << ": cold " << cold_us / 1000 << " ms";
+			if (warmup_runs > 1) msg << ", warm " << warm_us / 1000 << " ms";
+			log.information(msg.str());
+		}
+		catch (std::exception& e)
+		{
+			log.error("Worker " + std::to_string(worker.index) + " failed to warm " + model.weights_file + " -> " + e.what());
+		}
+	}
+	//Cold runs would skew the per image time reported at shutdown.
+	for (auto& [key, engine] : worker.engines) engine->ResetForwardTimings();
+
+	if (--workers_warming == 0)
+	{
+		log.information("Detector ready " + std::to_string(start_time.elapsed() / 1000) + " ms after start");
+		ev_ready.set();
+	}
 }
 
 void Detector::run()
+{
+	for (auto& worker : workers)
+	{
+		if (Poco::Thread::current() == &worker->thread) WorkerLoop(*worker);
+	}
+}
+
+bool Detector::TakeJob(DetectionJob& job, const long wait_ms, const ModelSpec* model)
+{
+	Poco::Timestamp wait_timer;
+	Poco::ScopedLock<Poco::Mutex> locker(mu_scheduler);
+	while (true)
+	{
+		if (scheduler.Pop(job, [model](const DetectionJob& queued) { return model == nullptr || queued.model.get() == model; })) return true;
+		long remaining_ms = wait_ms - (long)(wait_timer.elapsed() / 1000);
+		if (remaining_ms <= 0 || want_to_stop) return false;
+		job_queued.tryWait(mu_scheduler, remaining_ms);
+	}
+}
+
+void Detector::WorkerLoop(Worker& worker)
 {
 	using namespace Poco;
+	CpuBudget::instance().PinDetectorWorker(worker.index);
 	if (use_low_priority) Thread::current()->setPriority(Thread::PRIO_LOW);
+	Warmup(worker);
+	std::vector<DetectionJob> batch;
 	while (!want_to_stop)
 	{
-		if (ev_job_queue.tryWait(100))
+		DetectionJob job = {};
+		if (!TakeJob(job, 100)) continue;
+		job.histograms->queue_wait->Observe(job.queued.elapsed());
+		batch.clear();
+		batch.push_back(job);
+		size_t batch_items = job.tiles.size();
+
+		//Hold the batch open for up to batch_wait_ms so other cameras' jobs for the same
+		//model can join it. A tiled job always runs whole, so a batch can end up larger
+		//than batch_size.
+		Poco::Timestamp batch_timer;
+		while (batch_items < batch_size)
 		{
-			DetectionJob job = { 0, cv::Mat(), "", 0.0, 0.0 };
+			long remaining_ms = std::max(batch_wait_ms - (long)(batch_timer.elapsed() / 1000), 0L);
+			if (!TakeJob(job, remaining_ms, batch.front().model.get())) break;
+			job.histograms->queue_wait->Observe(job.queued.elapsed());
+			batch.push_back(job);
+			batch_items += job.tiles.size();
+		}
+
+		Poco::Timestamp detection_timer;
+		std::vector<std::vector<Detection>> batch_detections;
+		std::vector<DetectionResult::StageTimes> batch_stages(batch.size());
+		DetectionResult::Status status = DetectionResult::Status::Completed;
+		try
+		{
+			batch_detections = detect(worker, batch, batch_stages);
+		}
+		catch (std::exception& e)
+		{
+			log.error(batch.front().src_name + " -> " + e.what());
+			status = DetectionResult::Status::Failed;
+			batch_detections.assign(batch.size(), std::vector<Detection>());
+			for (size_t b = 0; b < batch.size(); ++b)
 			{
-				ScopedLock<Mutex> locker(mu_job_queue);
-				job = job_queue.front();
-				job_queue.pop();
+				Detection null_detection;
+				null_detection.src_name = batch[b].src_name;
+				batch_detections[b].push_back(null_detection);
 			}
-			Poco::Timestamp detection_timer;
-			auto detections = detect(job.frame, job.src_name, job.confidence_threshold, job.nms_threshold);
-			auto time_to_detect = detection_timer.elapsed();
-			DetectionResult detection_result = { detections, time_to_detect };
+		}
+		auto time_to_detect = detection_timer.elapsed();
+		busy_us += time_to_detect;
+		RecordBatch(batch_items);
+
+		for (size_t b = 0; b < batch.size(); ++b)
+		{
+			if (status == DetectionResult::Status::Completed)
 			{
-				ScopedLock<Mutex> locker(mu_job_output_map);
-				job_output_map[job.job_id] = detection_result;
+				const StageHistograms& histograms = *batch[b].histograms;
+				histograms.preprocess->Observe(batch_stages[b].preprocess_us);
+				histograms.forward->Observe(batch_stages[b].forward_us);
+				histograms.decode->Observe(batch_stages[b].decode_us);
+				histograms.nms->Observe(batch_stages[b].nms_us);
 			}
+			DetectionResult detection_result = { std::move(batch_detections[b]), time_to_detect, status, batch_stages[b] };
+			CompleteJob(batch[b], detection_result);
 		}
+		batch.clear();
+	}
+}
+
+void Detector::RecordBatch(const size_t batch_fill)
+{
+	uint64_t batches = ++batch_count;
+	uint64_t jobs = (batched_jobs += batch_fill);
+	if (batch_size > 1 && batches % 1000 == 0)
+	{
+		std::stringstream msg;
+		msg << "Batch fill " << std::setprecision(3) << (double)jobs / (double)batches << " of " << batch_size
+			<< " over " << batches << " batches";
+		log.information(msg.str());
+	}
+}
+
+Detector::BatchStats Detector::GetBatchStats() const
+{
+	BatchStats stats = { batch_count.load(), batched_jobs.load(), batch_size };
+	return stats;
+}
+
+Detector::LoadStats Detector::GetLoadStats()
+{
+	LoadStats stats = { workers.size(), busy_us.load(), 0, 0, 0 };
+	Poco::ScopedLock<Poco::Mutex> locker(mu_scheduler);
+	for (const auto& [src_name, source_stats] : scheduler.Stats())
+	{
+		stats.jobs_run += source_stats.scheduled;
+		stats.total_wait_us += source_stats.total_wait_us;
 	}
+	stats.queued = scheduler.size();
+	return stats;
 }
 
 void Detector::stop()
 {
 	want_to_stop = true;
-	job_thread.join();
+	{
+		Poco::ScopedLock<Poco::Mutex> locker(mu_scheduler);
+		job_queued.broadcast();
+	}
+	for (auto& worker : workers)
+	{
+		if (worker->thread.isRunning()) worker->thread.join();
+	}
+
+	for (const auto& [src_name, stats] : GetQueueStats())
+	{
+		std::stringstream msg;
+		msg << src_name << ": " << stats.scheduled << " jobs run, " << stats.superseded << " superseded, " << stats.cancelled
+			<< " cancelled, " << stats.dropped << " dropped, " << stats.rejected << " rejected, " << stats.queued << " left queued, wait " << std::fixed << std::setprecision(1)
+			<< (stats.scheduled ? (double)stats.total_wait_us / 1000.0 / (double)stats.scheduled : 0.0) << " ms mean, "
+			<< stats.max_wait_us / 1000.0 << " ms max";
+		log.information(msg.str());
+	}
+	log.information("Frames held by the detector peaked at " + std::to_string(peak_frame_bytes / (1024 * 1024)) + " MB");
+
+	for (auto& worker : workers)
+	{
+		for (const auto& [key, engine] : worker->engines)
+		{
+			const InferenceEngine::Timings& timings = engine->GetTimings();
+			if (timings.forwards == 0) continue;
+			std::stringstream msg;
+			msg << "Worker " << worker->index << " " << engine->Name() << " " << key << ": load " << timings.load_us / 1000 << " ms, "
+				<< timings.forwards << " forwards of " << timings.images << " images, " << std::fixed << std::setprecision(1)
+				<< (double)timings.forward_us / 1000.0 / (double)timings.images << " ms per image";
+			log.information(msg.str());
+		}
+	}
 }
 
 
-std::vector<Detection> Detector::detect(const cv::Mat frame, const std::string src_name, const float confidence_threshold, const float nms_threshold)
+std::vector<std::vector<Detection>> Detector::detect(Worker& worker, const std::vector<DetectionJob>& batch, std::vector<DetectionResult::StageTimes>& stages)
 {
 	using namespace std;
 	using namespace cv;
-	using namespace Poco;
-	
-	vector<Detection> detections;
-	vector<vector<Mat>> network_outputs;
-	vector<int> classIds;
-	vector<float> confidences;
-	vector<Rect> boxes;
-	
-	auto blob_img = dnn::blobFromImage(frame, 1.0 / 255.0, analysis_size, Scalar(), true, false);
-	yolo_net.setInput(blob_img);
-	yolo_net.forward(network_outputs, output_layers);
-	
-	for (auto output : network_outputs)
-	{
-		for (auto detection : output)
+
+	const ModelSpec& model = *batch.front().model;
+	vector<BatchItem> items;
+	for (size_t b = 0; b < batch.size(); ++b)
+	{
+		for (const auto& tile : batch[b].tiles)
 		{
-			float* data = (float*)detection.data;
-			for (int j = 0; j < detection.rows; ++j, data += detection.cols)
-			{
-				Mat scores = detection.row(j).colRange(5, detection.cols);
-				Point classIdPoint;
-				double confidence;
-				minMaxLoc(scores, 0, &confidence, 0, &classIdPoint);
-				if (confidence > confidence_threshold)
-				{
-					int centerX = (int)(data[0] * frame.cols);
-					int centerY = (int)(data[1] * frame.rows);
-					int width = (int)(data[2] * frame.cols);
-					int height = (int)(data[3] * frame.rows);
-					int left = centerX - width / 2;
-					int top = centerY - height / 2;
-
-					classIds.push_back(classIdPoint.x);
-					confidences.push_back((float)confidence);
-					boxes.push_back(Rect(left, top, width, height));
-				}
-			}
+			BatchItem item = { b, tile };
+			items.push_back(item);
 		}
 	}
 
-	map<int, vector<size_t> > class2indices;
-	for (size_t i = 0; i < classIds.size(); i++)
+	//Every tile of every job in the batch may be masked out.
+	vector<Mat> network_outputs;
+	vector<BoxMapping> mappings;
+	int64_t preprocess_us = 0;
+	int64_t forward_us = 0;
+	if (!items.empty())
 	{
-		if (confidences[i] >= confidence_threshold)
+		Poco::Timestamp stage_timer;
+		Mat blob_img = FramePreprocessor::PrepareBlob(worker.input_storage, (int)items.size(), model.input_size);
+		for (size_t i = 0; i < items.size(); ++i)
 		{
-			class2indices[classIds[i]].push_back(i);
+			const Rect& tile = items[i].tile;
+			BoxMapping mapping = worker.preprocessor.Process(batch[items[i].job].frame(tile), blob_img, (int)i, use_letterbox);
+			mapping.offset_x += tile.x;
+			mapping.offset_y += tile.y;
+			mappings.push_back(mapping);
 		}
+
+		preprocess_us = stage_timer.elapsed();
+
+		InferenceEngine& engine = GetEngine(worker, model);
+		stage_timer.update();
+		engine.Forward(blob_img, network_outputs);
+		forward_us = stage_timer.elapsed();
 	}
-	vector<Rect> nmsBoxes;
-	vector<float> nmsConfidences;
-	vector<int> nmsClassIds;
-	for (map<int, vector<size_t> >::iterator it = class2indices.begin(); it != class2indices.end(); ++it)
+
+	vector<vector<Detection>> batch_detections;
+	size_t first_item = 0;
+	for (size_t b = 0; b < batch.size(); ++b)
 	{
-		vector<Rect> localBoxes;
-		vector<float> localConfidences;
-		vector<size_t> classIndices = it->second;
-		for (size_t i = 0; i < classIndices.size(); i++)
-		{
-			localBoxes.push_back(boxes[classIndices[i]]);
-			localConfidences.push_back(confidences[classIndices[i]]);
-		}
-		vector<int> nmsIndices;
-		dnn::NMSBoxes(localBoxes, localConfidences, confidence_threshold, nms_threshold, nmsIndices);
-		for (size_t i = 0; i < nmsIndices.size(); i++)
+		stages[b].preprocess_us = preprocess_us;
+		stages[b].forward_us = forward_us;
+		batch_detections.push_back(ExtractDetections(worker, network_outputs, first_item, mappings, batch[b], stages[b]));
+		first_item += batch[b].tiles.size();
+	}
+	return batch_detections;
+}
+
+//All of a job's tiles are decoded into one candidate set before NMS, which
+//merges the duplicates found where neighbouring tiles overlap.
+std::vector<Detection> Detector::ExtractDetections(Worker& worker, const std::vector<cv::Mat>& network_outputs, const size_t first_item, const std::vector<BoxMapping>& mappings,
+	const DetectionJob& job, DetectionResult::StageTimes& stages)
+{
+	using namespace std;
+	using namespace cv;
+
+	const cv::Mat& frame = job.frame;
+	const std::string& src_name = job.src_name;
+	const float confidence_threshold = job.confidence_threshold;
+	const float nms_threshold = job.nms_threshold;
+	const ModelSpec& model = *job.model;
+	const vector<string>& classes = model.classes;
+
+	vector<Detection> detections;
+	DetectionCandidates& candidates = worker.candidates;
+	candidates.clear();
+	Poco::Timestamp stage_timer;
+
+	//With a batch of one the region layers produce [rows x cols]. With a larger batch
+	//they produce [batch x rows x cols] and each item has its own plane.
+	for (size_t item = first_item; item < first_item + job.tiles.size(); ++item)
+	{
+		for (const auto& output : network_outputs)
 		{
-			size_t idx = nmsIndices[i];
-			nmsBoxes.push_back(localBoxes[idx]);
-			nmsConfidences.push_back(localConfidences[idx]);
-			nmsClassIds.push_back(it->first);
+			CV_Assert(output.type() == CV_32F && output.isContinuous());
+			const int rows = output.dims == 3 ? output.size[1] : output.rows;
+			const int cols = output.dims == 3 ? output.size[2] : output.cols;
+			const float* data = output.dims == 3 ? output.ptr<float>((int)item) : output.ptr<float>();
+			BoxMapping mapping = mappings[item];
+			if (!model.normalized_boxes)
+			{
+				mapping.scale_x /= (float)model.input_size.width;
+				mapping.scale_y /= (float)model.input_size.height;
+			}
+			YoloDecoder::Decode(data, rows, cols, confidence_threshold, mapping, candidates, !model.scores_include_objectness);
 		}
 	}
-	boxes = nmsBoxes;
-	classIds = nmsClassIds;
-	confidences = nmsConfidences;
 
+	//Boxes the mask rejects can't be reported, so they go before NMS where they
+	//could suppress an overlapping box the mask accepts.
+	if (!job.mask.isNull())
+	{
+		candidates.filter([&](const size_t idx)
+		{
+			return job.mask->Accepts(Rect(candidates.left[idx], candidates.top[idx], candidates.width[idx], candidates.height[idx]), frame.size());
+		});
+	}
+	stages.decode_us = stage_timer.elapsed();
 
+	vector<int>& kept = worker.kept;
+	stage_timer.update();
+	worker.nms.Run(candidates, confidence_threshold, nms_threshold, kept);
+	stages.nms_us = stage_timer.elapsed();
 
-	for (size_t idx = 0; idx < boxes.size(); ++idx)
+	for (int idx : kept)
 	{
+		Rect box(candidates.left[idx], candidates.top[idx], candidates.width[idx], candidates.height[idx]);
+		//A names file shorter than the network's class count must not take the worker down.
+		if (candidates.class_id[idx] >= (int)classes.size()) continue;
+
 		Detection detection;
-		detection.bounding_box = boxes[idx];
-		detection.confidence = confidences[idx];
-		detection.detection_class = classes[classIds[idx]];
+		detection.bounding_box = box;
+		detection.confidence = candidates.confidence[idx];
+		detection.detection_class = classes[candidates.class_id[idx]];
 		detection.is_null = false;
 		detection.frame = frame;
+		detection.frame_time = job.captured;
 		detection.src_name = src_name;
 		detections.push_back(detection);
 	}
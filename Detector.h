@@ -1,22 +1,37 @@
 #pragma once
 #include <string>
 #include <vector>
-#include <queue>
 #include <map>
 #include <optional>
+#include <functional>
+#include <atomic>
 #include <cinttypes>
 
 #include <Poco/AutoPtr.h>
+#include <Poco/SharedPtr.h>
 #include <Poco/Logger.h>
 #include <Poco/Runnable.h>
 #include <Poco/Thread.h>
+#include <Poco/Mutex.h>
+#include <Poco/Condition.h>
+#include <Poco/Event.h>
+#include <Poco/Timestamp.h>
 #include <Poco/BasicEvent.h>
 #include <Poco/Util/ConfigurationView.h>
 
 
-#include <opencv2/dnn.hpp>
+#include <opencv2/core.hpp>
 
 #include "Detection.h"
+#include "DetectionCandidates.h"
+#include "ClassAwareNms.h"
+#include "FramePreprocessor.h"
+#include "TileLayout.h"
+#include "DetectionMask.h"
+#include "ModelRegistry.h"
+#include "InferenceEngine.h"
+#include "JobScheduler.h"
+#include "Metrics.h"
 
 class Detector : public Poco::Runnable
 {
@@ -28,51 +43,249 @@ public:
 	void run();
 	void stop();
 
+	//Every worker first runs detector.warmup_runs forwards through each model
+	//and batch size the configured sources will use, so the first real frame is
+	//not the one paying for OpenCV's allocations and kernel selection. Jobs
+	//submitted meanwhile simply wait in the queue.
+	bool IsReady() const { return workers_warming == 0; }
+	bool WaitUntilReady(const long timeout_ms);
+
 	struct DetectionResult
 	{
+		//Superseded, Cancelled and Dropped jobs never ran and carry no detections.
+		//Failed jobs carry a single null detection.
+		enum class Status { Completed, Failed, Superseded, Cancelled, Dropped };
+
+		//Where detection_time_us went. Preprocess and forward cover the whole
+		//batch the job ran in, decode and NMS only the job's own output.
+		struct StageTimes
+		{
+			int64_t preprocess_us = 0;
+			int64_t forward_us = 0;
+			int64_t decode_us = 0;
+			int64_t nms_us = 0;
+		};
+
 		std::vector<Detection> detections;
 		int64_t detection_time_us;
+		Status status = Status::Completed;
+		StageTimes stages;
+	};
+
+	struct BatchStats
+	{
+		uint64_t batches;
+		uint64_t jobs;
+		size_t batch_size;
 	};
 
-	uint64_t SubmitDetectionJob(const cv::Mat frame, const std::string src_name, const float confidence_threshold, const float nms_threshold);
+	//Per camera settings, applied to every job submitted under that source name.
+	struct SourceProfile
+	{
+		TileLayout tiling;
+		Poco::AutoPtr<DetectionMask> mask;
+		//The detector's default model when not set.
+		Poco::SharedPtr<const ModelSpec> model;
+		//Higher priority sources are always served first. Sources of equal priority
+		//share the workers in proportion to their weight.
+		int priority = 0;
+		double weight = 1.0;
+		//A job queued longer than this is superseded by the source's next job. 0 never.
+		Poco::Timestamp::TimeDiff deadline_us = 0;
+		//Models the source may be switched to later, warmed up along with model.
+		std::vector<Poco::SharedPtr<const ModelSpec>> alternate_models;
+	};
+	void ConfigureSource(const std::string& src_name, const SourceProfile& profile);
+
+	//The model named by a camera's yolo.* keys, falling back to the detector.* keys
+	//for any that are not set.
+	Poco::SharedPtr<const ModelSpec> ResolveModel(const Poco::Util::AbstractConfiguration& camera_config);
+	//The same model run at a different input size.
+	Poco::SharedPtr<const ModelSpec> ResolveModel(const Poco::Util::AbstractConfiguration& camera_config, const int analysis_size);
+
+	//Called on a detector worker thread as soon as the job finishes. The handler may
+	//move the result out. Jobs submitted with a handler are never held by the detector.
+	typedef std::function<void(const uint64_t job_id, DetectionResult& result)> CompletionHandler;
+
+	//Queued jobs and the frames they hold are bounded by detector.queue_capacity
+	//and detector.frame_memory_mb. What gives way when either is reached is
+	//up to detector.queue_policy. Jobs dropped to make room are reported to
+	//their submitters with Status::Dropped.
+	struct Submission
+	{
+		enum class Status { Queued, QueuedAfterDropping, Rejected };
+
+		Status status;
+		uint64_t job_id;
+	};
+
+	//captured is when the frame was read from its source, and becomes each detection's frame_time.
+	Submission SubmitDetectionJob(const cv::Mat frame, const Poco::Timestamp& captured, const std::string src_name, const float confidence_threshold, const float nms_threshold,
+		CompletionHandler on_complete = CompletionHandler());
+
+	//For jobs submitted without a handler. A completed result is handed out once and then forgotten.
 	std::optional<DetectionResult> GetDetectionJobIfComplete(const uint64_t job_id);
 
+	//Only a job still waiting in the queue can be cancelled. It is reported to
+	//its submitter with Status::Cancelled.
+	bool CancelDetectionJob(const uint64_t job_id);
+	//True when the job is still queued past its source's deadline. Submitting a
+	//fresher frame for the source will supersede it.
+	bool IsDetectionJobOverdue(const uint64_t job_id);
+	std::map<std::string, SourceQueueStats> GetQueueStats();
+	BatchStats GetBatchStats() const;
+
+	//Running totals since start. Callers sample twice and take the difference.
+	struct LoadStats
+	{
+		size_t workers;
+		//Time workers spent running jobs, summed over workers.
+		int64_t busy_us;
+		uint64_t jobs_run;
+		//Time jobs waited in the queue before a worker took them.
+		int64_t total_wait_us;
+		size_t queued;
+	};
+	LoadStats GetLoadStats();
+
 
 
 private:
 	volatile bool want_to_stop;
+	Poco::Logger& log;
 
-	std::vector<std::string> classes;
-	
-	cv::dnn::dnn4_v20200609::Net yolo_net;
-	
-	std::vector<cv::String> output_layers;
-	cv::Size analysis_size;
-	
-	int StrToBackend(const std::string& tech);
-	int StrToTarget(const std::string& target);
+	ModelRegistry model_registry;
+	Poco::SharedPtr<const ModelSpec> default_model;
+	std::string default_config_name;
+	std::string default_weights_name;
+	std::string default_names_name;
+	int default_analysis_size;
+	std::string default_output_layout;
 
-	uint64_t job_id_counter;
-	std::vector<Detection> detect(const cv::Mat frame, const std::string src_name, const float confidence_threshold, const float nms_threshold);
+	std::string engine_name;
+	InferenceEngine::Options engine_options;
+	bool use_letterbox;
+
+	std::atomic<uint64_t> job_id_counter;
+
+	//Per source, looked up when the source's first job is planned. Guarded by mu_source_profiles.
+	struct StageHistograms
+	{
+		LatencyHistogram* queue_wait;
+		LatencyHistogram* preprocess;
+		LatencyHistogram* forward;
+		LatencyHistogram* decode;
+		LatencyHistogram* nms;
+	};
+	std::map<std::string, StageHistograms> source_histograms;
 
 	struct DetectionJob
 	{
 		uint64_t job_id;
 		cv::Mat frame;
+		Poco::Timestamp captured;
 		std::string src_name;
 		float confidence_threshold;
 		float nms_threshold;
+		CompletionHandler on_complete;
+		//Regions of the frame run through the network, together in one batch.
+		std::vector<cv::Rect> tiles;
+		Poco::AutoPtr<DetectionMask> mask;
+		Poco::SharedPtr<const ModelSpec> model;
+		size_t frame_bytes;
+		const StageHistograms* histograms;
+		Poco::Timestamp queued;
 	};
 
-	Poco::Mutex mu_job_queue;
-	Poco::Event ev_job_queue;
-	std::queue<DetectionJob> job_queue;
-	Poco::Thread job_thread;
+
+	Poco::Mutex mu_source_profiles;
+	std::map<std::string, SourceProfile> source_profiles;
+	void PlanJob(DetectionJob& job);
+
+	//Each worker owns its own engine for every network it has run since an
+	//engine cannot be run from more than one thread at a time. Engines are
+	//loaded the first time a job for them reaches the worker. Workers all
+	//take their jobs from the one scheduler.
+	struct Worker
+	{
+		size_t index;
+		std::map<std::string, Poco::SharedPtr<InferenceEngine>> engines;
+		FramePreprocessor preprocessor;
+		cv::Mat input_storage;
+		DetectionCandidates candidates;
+		ClassAwareNms nms;
+		std::vector<int> kept;
+		Poco::Thread thread;
+	};
+
+	std::vector<Poco::SharedPtr<Worker>> workers;
 	bool use_low_priority;
 
-	
+	Poco::Mutex mu_scheduler;
+	Poco::Condition job_queued;
+	JobScheduler<DetectionJob> scheduler;
+
+	//reject turns new jobs away when full. drop_oldest makes room by dropping the
+	//submitting source's oldest job, or failing that the oldest job of the source
+	//with the most queued. keep_latest also drops a source's queued jobs whenever
+	//it submits a new one.
+	enum class QueuePolicy { Reject, DropOldest, KeepLatest };
+	QueuePolicy queue_policy;
+	size_t queue_capacity;
+	size_t frame_memory_budget;
+	//Frames of every job from submission until completion, queued or running.
+	std::atomic<size_t> frame_bytes_held;
+	size_t peak_frame_bytes;
+
+	size_t batch_size;
+	long batch_wait_ms;
+	std::atomic<uint64_t> batch_count;
+	std::atomic<uint64_t> batched_jobs;
+	std::atomic<int64_t> busy_us;
+	void RecordBatch(const size_t batch_fill);
 
+	//One network input: a tile of a job's frame.
+	struct BatchItem
+	{
+		size_t job;
+		cv::Rect tile;
+	};
+
+	InferenceEngine& GetEngine(Worker& worker, const ModelSpec& model);
+	//Waits up to wait_ms for a job. With a model given only that model's jobs are
+	//taken, since a batch runs through one network.
+	bool TakeJob(DetectionJob& job, const long wait_ms, const ModelSpec* model = nullptr);
+	void ReportUnrun(std::vector<DetectionJob>& jobs, const DetectionResult::Status status);
+
+	struct WarmupShape
+	{
+		Poco::SharedPtr<const ModelSpec> model;
+		int batch;
+	};
+	int warmup_runs;
+	std::vector<WarmupShape> warmup_plan;
+	std::atomic<size_t> workers_warming;
+	Poco::Event ev_ready;
+	Poco::Timestamp start_time;
+	void PlanWarmup();
+	void Warmup(Worker& worker);
+	void WorkerLoop(Worker& worker);
+	std::vector<std::vector<Detection>> detect(Worker& worker, const std::vector<DetectionJob>& batch, std::vector<DetectionResult::StageTimes>& stages);
+	std::vector<Detection> ExtractDetections(Worker& worker, const std::vector<cv::Mat>& network_outputs, const size_t first_item, const std::vector<BoxMapping>& mappings,
+		const DetectionJob& job, DetectionResult::StageTimes& stages);
+
+	void CompleteJob(DetectionJob& job, DetectionResult& result);
+
+	//Results nobody collects are dropped after result_ttl_ms or once more
+	//than result_capacity are waiting, oldest first.
+	struct StoredResult
+	{
+		DetectionResult result;
+		Poco::Timestamp completed;
+	};
 	Poco::Mutex mu_job_output_map;
-	std::map<uint64_t, DetectionResult> job_output_map;
+	std::map<uint64_t, StoredResult> job_output_map;
+	size_t result_capacity;
+	Poco::Timestamp::TimeDiff result_ttl_us;
 };
 
@@ -0,0 +1,359 @@
+//Replays a folder of images or a video file through Detector, the same code
+//path the cameras use, once for every combination of worker count and batch
+//size asked for. Frames are decoded up front so only detection is measured.
+//Reports latency percentiles for each stage, frames per second and the peak
+//working set of each run, and writes them as JSON so runs from different
+//builds can be compared.
+//
+//DetectorBench <properties_file> <frames_dir|video_file> [options]
+//  --workers <list>     detector.workers values to run, comma separated (1)
+//  --batch <list>       detector.batch_size values to run, comma separated (1)
+//  --frames <n>         frames submitted per run. Short inputs are replayed (200)
+//  --in_flight <n>      jobs submitted and not yet finished at once (2 x workers x batch)
+//  --conf <f>           confidence threshold (0.35)
+//  --nms <f>            NMS threshold (0.48)
+//  --output <file>      JSON report (detector_bench.json)
+
+#include <Poco/AutoPtr.h>
+#include <Poco/DateTimeFormat.h>
+#include <Poco/DateTimeFormatter.h>
+#include <Poco/DirectoryIterator.h>
+#include <Poco/Event.h>
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Mutex.h>
+#include <Poco/NumberParser.h>
+#include <Poco/Path.h>
+#include <Poco/Runnable.h>
+#include <Poco/Semaphore.h>
+#include <Poco/String.h>
+#include <Poco/StringTokenizer.h>
+#include <Poco/Thread.h>
+#include <Poco/Timestamp.h>
+#include <Poco/Util/LayeredConfiguration.h>
+#include <Poco/Util/MapConfiguration.h>
+#include <Poco/Util/PropertyFileConfiguration.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "json/json.h"
+#include "CpuBudget.h"
+#include "Detector.h"
+
+using namespace std;
+using namespace cv;
+
+
+//Latency samples of one stage, in microseconds.
+struct StageSamples
+{
+	vector<int64_t> us;
+
+	Json::Value Summary()
+	{
+		Json::Value summary;
+		if (us.empty()) return summary;
+		sort(us.begin(), us.end());
+		auto percentile = [this](const double p) { return us[min((size_t)(p * (double)us.size()), us.size() - 1)] / 1000.0; };
+		summary["p50_ms"] = percentile(0.50);
+		summary["p90_ms"] = percentile(0.90);
+		summary["p99_ms"] = percentile(0.99);
+		summary["max_ms"] = us.back() / 1000.0;
+		return summary;
+	}
+};
+
+static const char* stage_names[] = { "preprocess", "forward", "decode", "nms", "detect", "end_to_end" };
+
+static vector<int> ParseList(const string& list)
+{
+	vector<int> values;
+	Poco::StringTokenizer tokenizer(list, ",", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+	for (const auto& token : tokenizer) values.push_back(max(Poco::NumberParser::parse(token), 1));
+	return values;
+}
+
+static vector<Mat> LoadFrames(const string& source, const size_t max_frames)
+{
+	vector<Mat> frames;
+	if (Poco::File(source).isDirectory())
+	{
+		vector<string> paths;
+		for (Poco::DirectoryIterator it(source), end; it != end; ++it)
+		{
+			const string extension = Poco::toLower(it.path().getExtension());
+			if (it->isFile() && (extension == "jpg" || extension == "jpeg" || extension == "png" || extension == "bmp")) paths.push_back(it->path());
+		}
+		sort(paths.begin(), paths.end());
+		for (const auto& path : paths)
+		{
+			if (frames.size() >= max_frames) break;
+			Mat frame = imread(path);
+			if (!frame.empty()) frames.push_back(frame);
+		}
+	}
+	else
+	{
+		VideoCapture video(source);
+		Mat frame;
+		while (frames.size() < max_frames && video.read(frame)) frames.push_back(frame.clone());
+	}
+	return frames;
+}
+
+//The memory the process holds right now.
+static double WorkingSetMB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0.0;
+	return counters.WorkingSetSize / (1024.0 * 1024.0);
+#else
+	//Pages in total, then pages resident.
+	ifstream statm("/proc/self/statm");
+	size_t pages = 0, resident = 0;
+	if (!(statm >> pages >> resident)) return 0.0;
+	return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+#endif
+}
+
+//Samples the working set on a thread of its own from construction until
+//Stop and keeps the largest. The OS keeps one peak for the whole process,
+//which would show every run the largest peak of the runs before it.
+class PeakWorkingSet : public Poco::Runnable
+{
+public:
+	PeakWorkingSet() : peak_mb(0.0) { thread.start(*this); }
+	~PeakWorkingSet() { Stop(); }
+
+	double Stop()
+	{
+		if (thread.isRunning())
+		{
+			stop.set();
+			thread.join();
+			peak_mb = max(peak_mb, WorkingSetMB());
+		}
+		return peak_mb;
+	}
+
+	void run() override
+	{
+		do peak_mb = max(peak_mb, WorkingSetMB());
+		while (!stop.tryWait(10));
+	}
+
+private:
+	Poco::Thread thread;
+	Poco::Event stop;
+	double peak_mb;
+};
+
+static Json::Value Run(Poco::Util::AbstractConfiguration& properties, const vector<Mat>& frames, const int workers, const int batch,
+	const size_t frame_count, size_t in_flight, const float confidence_threshold, const float nms_threshold)
+{
+	if (in_flight == 0) in_flight = (size_t)(2 * workers * batch);
+
+	//Everything not overridden here comes from the properties file, as it would for the service.
+	Poco::AutoPtr<Poco::Util::MapConfiguration> overrides = new Poco::Util::MapConfiguration;
+	overrides->setInt("detector.workers", workers);
+	overrides->setInt("detector.batch_size", batch);
+	overrides->setString("detector.queue_policy", "reject");
+	overrides->setInt("detector.queue_capacity", (int)in_flight);
+	Poco::Util::LayeredConfiguration config;
+	config.add(overrides, -1);
+	config.add(Poco::AutoPtr<Poco::Util::AbstractConfiguration>(&properties, true), 0);
+
+	CpuBudget::instance().Configure(config);
+	//Loading the networks counts towards the run's peak.
+	PeakWorkingSet peak_working_set;
+	Poco::Timestamp load_timer;
+	Detector detector(config);
+	detector.start();
+	detector.WaitUntilReady(config.getInt("detector.ready_timeout_s", 300) * 1000L);
+	const int64_t startup_us = load_timer.elapsed();
+
+	Poco::Mutex mu_samples;
+	StageSamples stages[6];
+	map<string, uint64_t> statuses;
+	Poco::Semaphore slots((int)in_flight);
+	Poco::Event all_done;
+	atomic<size_t> finished(0);
+	uint64_t rejected = 0;
+
+	Poco::Timestamp run_timer;
+	for (size_t f = 0; f < frame_count; ++f)
+	{
+		slots.wait();
+		while (true)
+		{
+			Poco::Timestamp submitted;
+			Detector::Submission submission = detector.SubmitDetectionJob(frames[f % frames.size()], submitted, "bench", confidence_threshold, nms_threshold,
+				[&, submitted](const uint64_t job_id, Detector::DetectionResult& result)
+				{
+					{
+						Poco::ScopedLock<Poco::Mutex> locker(mu_samples);
+						const int64_t values[] = { result.stages.preprocess_us, result.stages.forward_us, result.stages.decode_us, result.stages.nms_us,
+							result.detection_time_us, submitted.elapsed() };
+						if (result.status == Detector::DetectionResult::Status::Completed)
+						{
+							for (int s = 0; s < 6; ++s) stages[s].us.push_back(values[s]);
+							statuses["completed"]++;
+						}
+						else
+						{
+							statuses[result.status == Detector::DetectionResult::Status::Failed ? "failed" : "not_run"]++;
+						}
+					}
+					slots.set();
+					if (++finished == frame_count) all_done.set();
+				});
+			if (submission.status != Detector::Submission::Status::Rejected) break;
+			//Frame memory rather than the queue is full. Give the workers a moment.
+			++rejected;
+			Poco::Thread::sleep(1);
+		}
+	}
+	all_done.wait();
+	const double wall_s = run_timer.elapsed() / 1000000.0;
+	const double peak_working_set_mb = peak_working_set.Stop();
+	detector.stop();
+
+	Detector::BatchStats batch_stats = detector.GetBatchStats();
+	Json::Value run;
+	run["workers"] = workers;
+	run["batch_size"] = batch;
+	run["in_flight"] = (Json::UInt64)in_flight;
+	run["frames"] = (Json::UInt64)frame_count;
+	run["startup_ms"] = startup_us / 1000.0;
+	run["wall_s"] = wall_s;
+	run["frames_per_s"] = frame_count / wall_s;
+	run["mean_batch_fill"] = batch_stats.batches ? (double)batch_stats.jobs / (double)batch_stats.batches : 0.0;
+	run["rejected_submissions"] = (Json::UInt64)rejected;
+	for (const auto& [status, count] : statuses) run["jobs"][status] = (Json::UInt64)count;
+	for (int s = 0; s < 6; ++s) run["latency"][stage_names[s]] = stages[s].Summary();
+	run["peak_working_set_mb"] = peak_working_set_mb;
+	return run;
+}
+
+static void PrintRun(const Json::Value& run)
+{
+	cout << setw(8) << run["workers"].asInt() << setw(7) << run["batch_size"].asInt() << setw(9) << run["frames_per_s"].asDouble();
+	for (const char* stage : stage_names)
+	{
+		const Json::Value& latency = run["latency"][stage];
+		cout << setw(11) << latency.get("p50_ms", 0.0).asDouble() << "/" << left << setw(8) << latency.get("p99_ms", 0.0).asDouble() << right;
+	}
+	cout << setw(9) << run["peak_working_set_mb"].asDouble() << endl;
+}
+
+int main(int argc, char** argv)
+{
+	vector<string> positional;
+	map<string, string> options;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (arg.compare(0, 2, "--") == 0 && i + 1 < argc) options[arg.substr(2)] = argv[++i];
+		else positional.push_back(arg);
+	}
+	if (positional.size() != 2)
+	{
+		cerr << "DetectorBench <properties_file> <frames_dir|video_file> [options]" << endl;
+		return 1;
+	}
+	auto option = [&](const string& key, const string& fallback) { return options.count(key) ? options[key] : fallback; };
+
+	try
+	{
+		const vector<int> worker_counts = ParseList(option("workers", "1"));
+		const vector<int> batch_sizes = ParseList(option("batch", "1"));
+		const size_t frame_count = (size_t)max(stoi(option("frames", "200")), 1);
+		const size_t in_flight = (size_t)max(stoi(option("in_flight", "0")), 0);
+		const float confidence_threshold = stof(option("conf", "0.35"));
+		const float nms_threshold = stof(option("nms", "0.48"));
+		const string output = option("output", "detector_bench.json");
+
+		Poco::Path properties_path(Poco::Path(positional[0]).absolute());
+		Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> properties = new Poco::Util::PropertyFileConfiguration(properties_path.toString());
+		//Models are found beneath application.dir, as they are for the service next to its properties file.
+		if (!properties->has("application.dir")) properties->setString("application.dir", properties_path.parent().toString());
+
+		const vector<Mat> frames = LoadFrames(positional[1], frame_count);
+		if (frames.empty())
+		{
+			cerr << "No frames found in " << positional[1] << endl;
+			return 1;
+		}
+		cout << frames.size() << " frames of " << frames.front().cols << "x" << frames.front().rows << " loaded from " << positional[1] << endl;
+
+		Json::Value report;
+		report["started"] = Poco::DateTimeFormatter::format(Poco::Timestamp(), Poco::DateTimeFormat::ISO8601_FORMAT);
+		report["build"]["opencv"] = CV_VERSION;
+		report["build"]["date"] = string(__DATE__) + " " + __TIME__;
+#ifdef _MSC_VER
+		report["build"]["compiler"] = "msvc " + to_string(_MSC_FULL_VER);
+#else
+		report["build"]["compiler"] = __VERSION__;
+#endif
+		report["properties"] = properties_path.toString();
+		report["source"] = positional[1];
+		report["model"]["config"] = properties->getString("detector.config", "yolov4-leaky-416.cfg");
+		report["model"]["weights"] = properties->getString("detector.weights", "yolov4-leaky-416.weights");
+		report["model"]["analysis_size"] = properties->getInt("detector.analysis_size", 416);
+		report["engine"] = properties->getString("detector.engine", "opencv");
+		report["backend"] = properties->getString("detector.backend", "");
+		report["target"] = properties->getString("detector.target", "");
+
+		cout << fixed << setprecision(1) << endl << "p50/p99 ms per stage" << endl;
+		cout << setw(8) << "workers" << setw(7) << "batch" << setw(9) << "fps";
+		for (const char* stage : stage_names) cout << setw(20) << stage;
+		cout << setw(9) << "peak MB" << endl;
+		for (int workers : worker_counts)
+		{
+			for (int batch : batch_sizes)
+			{
+				Json::Value run = Run(*properties, frames, workers, batch, frame_count, in_flight, confidence_threshold, nms_threshold);
+				PrintRun(run);
+				report["runs"].append(run);
+			}
+		}
+
+		Json::StreamWriterBuilder writer;
+		writer["indentation"] = "  ";
+		std::ofstream out(output);
+		out << Json::writeString(writer, report) << endl;
+		if (!out) throw Poco::WriteFileException(output);
+		cout << endl << "Report written to " << output << endl;
+	}
+	catch (Poco::Exception& e)
+	{
+		cerr << e.displayText() << endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
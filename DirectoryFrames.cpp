@@ -3,14 +3,25 @@
 #include <Poco/Timestamp.h>
 #include <Poco/FileStream.h>
 #include <Poco/Logger.h>
+#include <Poco/Exception.h>
 #include <opencv2/opencv.hpp>
 
 using namespace Poco;
 
-DirectoryFrames::DirectoryFrames(const std::string& directory_path, const int scan_interval ):
+DirectoryFrames::DirectoryFrames(const std::string& source_name, const std::string& directory_path, const int decode_scale, const int scan_interval ):
 watcher(directory_path, DirectoryWatcher::DW_ITEM_ADDED, scan_interval),
-want_to_stop(false)
+want_to_stop(false),
+grab_histogram(Metrics::instance().Histogram("od_grab_seconds", "Time spent reading and decoding a frame from the camera", "camera", source_name)),
+decode_scale(decode_scale)
 {
+	switch (decode_scale)
+	{
+	case 1: imread_flags = cv::IMREAD_COLOR; break;
+	case 2: imread_flags = cv::IMREAD_REDUCED_COLOR_2; break;
+	case 4: imread_flags = cv::IMREAD_REDUCED_COLOR_4; break;
+	case 8: imread_flags = cv::IMREAD_REDUCED_COLOR_8; break;
+	default: throw Poco::InvalidArgumentException("decode_scale must be 1, 2, 4 or 8");
+	}
 	watcher.itemAdded += delegate(this, &DirectoryFrames::onItemAdded);
 }
 
@@ -32,7 +43,7 @@ void DirectoryFrames::stop()
 	//TODO remove the delegate?
 }
 
-cv::Mat DirectoryFrames::GetNextFrame(const int wait_ms)
+cv::Mat DirectoryFrames::GetNextFrame(Poco::Timestamp& captured, const int wait_ms)
 {
 	cv::Mat empty_frame;
 	while (!want_to_stop)
@@ -49,7 +60,14 @@ cv::Mat DirectoryFrames::GetNextFrame(const int wait_ms)
 			if (added_file.exists())
 			{
 				if (WaitForFileToComplete(added_file))
-					return cv::imread(added_file.path());
+				{
+					Timestamp grab_timer;
+					cv::Mat frame = cv::imread(added_file.path(), imread_flags);
+					grab_histogram.Observe(grab_timer.elapsed());
+					captured = grab_timer;
+					if (!history.isNull()) history->Add(frame, captured);
+					return frame;
+				}
 			}
 		}
 		else
@@ -6,23 +6,32 @@
 #include <Poco/Thread.h>
 #include <queue>
 #include "FrameSource.h"
+#include "Metrics.h"
 
 class DirectoryFrames : public FrameSource
 {
 public:
-	DirectoryFrames(const std::string& directory_path, const int scan_interval = Poco::DirectoryWatcher::DW_DEFAULT_SCAN_INTERVAL);
+	//With a decode_scale of 2, 4 or 8 JPEGs are decoded straight to the smaller
+	//size by DCT scaling. Other formats are decoded whole and then shrunk.
+	DirectoryFrames(const std::string& source_name, const std::string& directory_path, const int decode_scale = 1,
+		const int scan_interval = Poco::DirectoryWatcher::DW_DEFAULT_SCAN_INTERVAL);
 
 	void onItemAdded(const void* sender, const Poco::DirectoryWatcher::DirectoryEvent& directoryEvent);
 	
 	void start() override;
-	cv::Mat GetNextFrame(const int wait_ms = 100) override;
+	cv::Mat GetNextFrame(Poco::Timestamp& captured, const int wait_ms = 100) override;
 	void stop() override;
+	int DecodeScale() const override { return decode_scale; }
+	bool DecodesOnCallingThread() const override { return true; }
 private:
 	Poco::DirectoryWatcher watcher;
 	Poco::Mutex mu_new_file_que;
 	std::queue<Poco::File> new_file_que;
 	Poco::Event file_added;
 	volatile bool want_to_stop;
+	LatencyHistogram& grab_histogram;
+	int decode_scale;
+	int imread_flags;
 	bool WaitForFileToComplete(const Poco::File& file, const int timeout_ms = 10000);
 };
 
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+
+#include <opencv2/dnn.hpp>
+
+//Configuration names for OpenCV's dnn backends and targets. Unknown names
+//fall back to the defaults.
+
+inline int StrToTarget(const std::string& target)
+{
+	using namespace cv::dnn;
+	if (target == "cuda") return DNN_TARGET_CUDA;
+	if (target == "cuda_fp16") return DNN_TARGET_CUDA_FP16;
+	if (target == "opencl") return DNN_TARGET_OPENCL;
+	if (target == "opencl_fp16") return DNN_TARGET_OPENCL_FP16;
+	if (target == "myriad") return DNN_TARGET_MYRIAD;
+	if (target == "vulkan") return DNN_TARGET_VULKAN;
+	if (target == "fpga") return DNN_TARGET_FPGA;
+	if (target == "cpu") return DNN_TARGET_CPU;
+
+	return DNN_TARGET_CPU;
+}
+
+inline int StrToBackend(const std::string& bkend)
+{
+	using namespace cv::dnn;
+	if (bkend == "cuda") return DNN_BACKEND_CUDA;
+	if (bkend == "halide") return DNN_BACKEND_HALIDE;
+	if (bkend == "intel_inference") return DNN_BACKEND_INFERENCE_ENGINE;
+	if (bkend == "opencv") return DNN_BACKEND_OPENCV;
+	if (bkend == "vkcom") return DNN_BACKEND_VKCOM;
+	if (bkend == "default") return DNN_BACKEND_DEFAULT;
+	return cv::dnn::DNN_BACKEND_DEFAULT;
+}
@@ -1,13 +1,17 @@
 #include "EventFilter.h"
 
-EventFilter::EventFilter(const std::vector<StringFilter> classFilterValues, const std::vector<StringFilter> sourceFilterValues) :
+#include <Poco/Timestamp.h>
+
+EventFilter::EventFilter(const std::string& emitter_name, const std::vector<StringFilter> classFilterValues, const std::vector<StringFilter> sourceFilterValues) :
 	classFilters(classFilterValues),
-	sourceFilters(sourceFilterValues)
+	sourceFilters(sourceFilterValues),
+	filter_histogram(Metrics::instance().Histogram("od_filter_seconds", "Time spent filtering detections for an emitter", "emitter", emitter_name))
 {
 }
 
 void EventFilter::onDetectionEvent(const void* sender, std::vector<Detection>& detections)
 {
+	Poco::Timestamp filter_timer;
 	std::vector<Detection> filteredDetections;
 
 	for (auto detection : detections)
@@ -44,5 +48,6 @@ void EventFilter::onDetectionEvent(const void* sender, std::vector<Detection>& d
 		filteredDetections.push_back(null_detection);
 	}
 
+	filter_histogram.Observe(filter_timer.elapsed());
 	filteredDetectionEvent.notify(this, filteredDetections);
 }
@@ -2,16 +2,18 @@
 #include <vector>
 #include "StringFilter.h"
 #include "Detection.h"
+#include "Metrics.h"
 #include <Poco/BasicEvent.h>
 class EventFilter
 {
 public:
-	EventFilter(const std::vector<StringFilter> classFilterValues, const std::vector<StringFilter> sourceFilterValues);
+	EventFilter(const std::string& emitter_name, const std::vector<StringFilter> classFilterValues, const std::vector<StringFilter> sourceFilterValues);
 
 	void onDetectionEvent(const void* sender, std::vector<Detection>& detections);
 	Poco::BasicEvent<std::vector<Detection>> filteredDetectionEvent;
 private:
 	std::vector<StringFilter> classFilters;
 	std::vector<StringFilter> sourceFilters;
+	LatencyHistogram& filter_histogram;
 };
 
@@ -0,0 +1,96 @@
+#include "FrameHistory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <opencv2/imgcodecs.hpp>
+
+Poco::Mutex FrameHistory::mu_registry;
+std::map<std::string, Poco::AutoPtr<FrameHistory>> FrameHistory::registry;
+
+FrameHistory::FrameHistory(const std::string& source_name, const double seconds, const double fps, const int jpeg_quality, const size_t max_frame_bytes) :
+	log(Poco::Logger::get(source_name)),
+	slots((size_t)std::max(std::ceil(seconds * fps), 1.0) + 1),
+	slot_bytes(max_frame_bytes),
+	written(0),
+	sample_period_us((Poco::Timestamp::TimeDiff)(1000000.0 / std::max(fps, 0.01))),
+	encode_params({ cv::IMWRITE_JPEG_QUALITY, std::clamp(jpeg_quality, 1, 100) }),
+	too_large(0)
+{
+	for (auto& slot : slots) slot.data.reset(new uchar[slot_bytes]);
+	//The first frame is due straight away.
+	sample_timer -= sample_period_us;
+	log.information("Keeping " + std::to_string(slots.size() - 1) + " frames of history, " +
+		std::to_string(slots.size() * slot_bytes / 1024) + " KB");
+}
+
+Poco::AutoPtr<FrameHistory> FrameHistory::FromConfig(const std::string& source_name, const Poco::Util::AbstractConfiguration& config)
+{
+	const double seconds = config.getDouble("history.seconds", 0.0);
+	if (seconds <= 0.0) return Poco::AutoPtr<FrameHistory>();
+	return new FrameHistory(source_name, seconds, config.getDouble("history.fps", 2.0), config.getInt("history.quality", 80),
+		(size_t)std::max(config.getInt("history.max_frame_kb", 512), 1) * 1024);
+}
+
+void FrameHistory::Register(const std::string& source_name, Poco::AutoPtr<FrameHistory> history)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_registry);
+	registry[source_name] = history;
+}
+
+Poco::AutoPtr<FrameHistory> FrameHistory::Find(const std::string& source_name)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_registry);
+	auto it = registry.find(source_name);
+	return it == registry.end() ? Poco::AutoPtr<FrameHistory>() : it->second;
+}
+
+void FrameHistory::Add(const cv::Mat& frame, const Poco::Timestamp& captured)
+{
+	if (frame.empty() || !Due()) return;
+	sample_timer.update();
+
+	cv::imencode(".jpg", frame, encoded, encode_params);
+	if (encoded.size() > slot_bytes)
+	{
+		if (too_large++ == 0) log.warning("A " + std::to_string(encoded.size() / 1024) + " KB frame does not fit history.max_frame_kb, skipping it");
+		return;
+	}
+
+	//Readers that see an odd sequence, or a different one once they are done, drop what they read.
+	Slot& slot = slots[written % slots.size()];
+	const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(slot.data.get(), encoded.data(), encoded.size());
+	slot.size.store(encoded.size(), std::memory_order_relaxed);
+	slot.captured.store(captured.epochMicroseconds(), std::memory_order_relaxed);
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+	written.store(written.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+std::vector<FrameHistory::Snapshot> FrameHistory::Window(const Poco::Timestamp& from, const Poco::Timestamp& to) const
+{
+	std::vector<Snapshot> snapshots;
+	const uint64_t newest = written.load(std::memory_order_acquire);
+	//The oldest slot is the one the writer fills next, so it is left alone.
+	const uint64_t available = std::min<uint64_t>(newest, slots.size() - 1);
+	for (uint64_t n = newest - available; n < newest; ++n)
+	{
+		const Slot& slot = slots[n % slots.size()];
+		const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+		if (sequence & 1) continue;
+		const Poco::Timestamp captured(slot.captured.load(std::memory_order_relaxed));
+		if (captured < from || captured > to) continue;
+
+		Snapshot snapshot;
+		snapshot.captured = captured;
+		snapshot.jpeg.assign(slot.data.get(), slot.data.get() + std::min(slot.size.load(std::memory_order_relaxed), slot_bytes));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		//Overwritten while it was being copied, by a frame newer than this window.
+		if (slot.sequence.load(std::memory_order_relaxed) != sequence) continue;
+		snapshots.push_back(std::move(snapshot));
+	}
+	return snapshots;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <memory>
+#include <cinttypes>
+
+#include <Poco/AutoPtr.h>
+#include <Poco/Logger.h>
+#include <Poco/Mutex.h>
+#include <Poco/RefCountedObject.h>
+#include <Poco/Timestamp.h>
+#include <Poco/Util/AbstractConfiguration.h>
+
+#include <opencv2/core.hpp>
+
+//The last history.seconds of a camera, sampled at history.fps and kept as one
+//JPEG per frame in a ring of fixed size slots allocated up front, so memory
+//stays bounded however long the camera runs. Anyone can pull the frames
+//around a detection afterwards, say to show what led up to it.
+//
+//One thread adds frames. Readers take no lock: each slot carries a sequence
+//number that is odd while the slot is being written, and a reader copies a
+//frame out only to throw it away if the number changed meanwhile. Only the
+//frames asked for are copied.
+class FrameHistory : public Poco::RefCountedObject
+{
+public:
+	FrameHistory(const std::string& source_name, const double seconds, const double fps, const int jpeg_quality, const size_t max_frame_bytes);
+
+	//Reads history.seconds, history.fps, history.quality and history.max_frame_kb
+	//from a camera's config. Null when history.seconds is 0.
+	static Poco::AutoPtr<FrameHistory> FromConfig(const std::string& source_name, const Poco::Util::AbstractConfiguration& config);
+
+	//Every camera's history, by source name, for consumers that only have a detection.
+	static void Register(const std::string& source_name, Poco::AutoPtr<FrameHistory> history);
+	static Poco::AutoPtr<FrameHistory> Find(const std::string& source_name);
+
+	//Writer only. True when the next frame should be added, so a source that
+	//decodes on demand knows to decode one.
+	bool Due() const { return sample_timer.isElapsed(sample_period_us); }
+	//Writer only. Encodes and stores the frame unless it isn't due yet.
+	void Add(const cv::Mat& frame, const Poco::Timestamp& captured = Poco::Timestamp());
+
+	struct Snapshot
+	{
+		Poco::Timestamp captured;
+		std::vector<uchar> jpeg;
+	};
+
+	//Frames captured between from and to inclusive, oldest first. Any thread.
+	std::vector<Snapshot> Window(const Poco::Timestamp& from, const Poco::Timestamp& to) const;
+	//The frames before_us ahead of and after_us past a moment, Ex. a detection's frame_time.
+	std::vector<Snapshot> Around(const Poco::Timestamp& at, const Poco::Timestamp::TimeDiff before_us, const Poco::Timestamp::TimeDiff after_us) const
+	{
+		return Window(at - before_us, at + after_us);
+	}
+
+	Poco::Timestamp::TimeDiff SamplePeriod() const { return sample_period_us; }
+	uint64_t FramesStored() const { return written; }
+	uint64_t FramesTooLarge() const { return too_large; }
+
+private:
+	Poco::Logger& log;
+
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence{ 0 };
+		std::atomic<Poco::Timestamp::TimeVal> captured{ 0 };
+		std::atomic<size_t> size{ 0 };
+		std::unique_ptr<uchar[]> data;
+	};
+	std::vector<Slot> slots;
+	size_t slot_bytes;
+	//Frames ever added. The newest is in slot (written - 1) % slots.size().
+	std::atomic<uint64_t> written;
+
+	Poco::Timestamp::TimeDiff sample_period_us;
+	Poco::Timestamp sample_timer;
+	std::vector<int> encode_params;
+	std::vector<uchar> encoded;
+	std::atomic<uint64_t> too_large;
+
+	static Poco::Mutex mu_registry;
+	static std::map<std::string, Poco::AutoPtr<FrameHistory>> registry;
+};
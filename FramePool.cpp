@@ -0,0 +1,65 @@
+#include "FramePool.h"
+
+#include <algorithm>
+
+//cv::Mat copies on other threads change the count with CV_XADD, so it is read
+//the same way: an atomic add of nothing returns the current count.
+static int ReferenceCount(const cv::Mat& frame)
+{
+	return CV_XADD(&frame.u->refcount, 0);
+}
+
+FramePool::FramePool(const size_t size) :
+	slots(std::max(size, (size_t)2)),
+	published(-1),
+	acquired(-1)
+{
+}
+
+cv::Mat* FramePool::Acquire()
+{
+	const int latest = published.load();
+	for (int index = 0; index < (int)slots.size(); ++index)
+	{
+		if (index == latest) continue;
+		Slot& slot = slots[index];
+		//A reader drops its pin only after its copy has taken a reference, so
+		//with no pins left the reference count is the whole story.
+		if (slot.pins.load() != 0) continue;
+		if (slot.frame.u != nullptr && ReferenceCount(slot.frame) > 1) continue;
+		acquired = index;
+		return &slot.frame;
+	}
+	acquired = -1;
+	return nullptr;
+}
+
+void FramePool::Publish(const Poco::Timestamp& captured)
+{
+	if (acquired < 0) return;
+	slots[acquired].captured = captured;
+	published.store(acquired);
+	acquired = -1;
+}
+
+cv::Mat FramePool::Latest(Poco::Timestamp& captured)
+{
+	while (true)
+	{
+		const int index = published.load();
+		if (index < 0) return cv::Mat();
+
+		Slot& slot = slots[index];
+		slot.pins.fetch_add(1);
+		//No longer the latest, so the producer may already be writing into it.
+		if (published.load() != index)
+		{
+			slot.pins.fetch_sub(1);
+			continue;
+		}
+		cv::Mat frame = slot.frame;
+		captured = slot.captured;
+		slot.pins.fetch_sub(1);
+		return frame;
+	}
+}
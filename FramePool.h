@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+#include <opencv2/core.hpp>
+#include <Poco/Timestamp.h>
+
+//A fixed set of frame buffers passed from one producer thread to any number of
+//readers without a lock. The producer decodes into a buffer nobody holds and
+//publishes it. Readers get the latest published frame as a cv::Mat sharing
+//the buffer, which is never written again until every reader has let it go.
+//Once each buffer has been sized by its first frame nothing is allocated.
+//
+//A reader pins the slot it is about to copy and checks it is still the
+//published one, and the producer skips pinned slots, so a buffer can't be
+//picked for writing between a reader finding it and taking its reference.
+class FramePool
+{
+public:
+	//At least two, one published and one to decode the next frame into.
+	explicit FramePool(const size_t size);
+
+	//Producer only. A buffer no reader holds, to be filled and then published,
+	//or nullptr when every buffer is still held.
+	cv::Mat* Acquire();
+	//Producer only. Makes the buffer from the last Acquire the latest frame, captured at that time.
+	void Publish(const Poco::Timestamp& captured);
+
+	//Any thread. The latest published frame, empty before the first, and when it was captured. Must not be written to.
+	cv::Mat Latest(Poco::Timestamp& captured);
+
+	size_t Size() const { return slots.size(); }
+
+private:
+	struct Slot
+	{
+		cv::Mat frame;
+		Poco::Timestamp captured;
+		std::atomic<int> pins{ 0 };
+	};
+	std::vector<Slot> slots;
+	std::atomic<int> published;
+	int acquired;
+};
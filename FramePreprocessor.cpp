@@ -0,0 +1,146 @@
+#include "FramePreprocessor.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+
+cv::Mat FramePreprocessor::PrepareBlob(cv::Mat& storage, const int batch_size, const cv::Size input_size)
+{
+	const int needed = batch_size * 3 * input_size.area();
+	if (storage.empty() || (int)storage.total() < needed)
+	{
+		storage.create(1, needed, CV_32F);
+	}
+	int sizes[] = { batch_size, 3, input_size.height, input_size.width };
+	return cv::Mat(4, sizes, CV_32F, storage.ptr<float>());
+}
+
+//Same sample positions as cv::resize with INTER_LINEAR.
+void FramePreprocessor::BuildTables(const cv::Size src, const cv::Rect dst)
+{
+	if (src == table_src && dst == table_dst) return;
+	table_src = src;
+	table_dst = dst;
+
+	x_offset.resize(dst.width * 2);
+	x_weight.resize(dst.width);
+	const double scale_x = (double)src.width / dst.width;
+	for (int dx = 0; dx < dst.width; ++dx)
+	{
+		double fx = (dx + 0.5) * scale_x - 0.5;
+		int x0 = (int)std::floor(fx);
+		float wx = (float)(fx - x0);
+		if (x0 < 0)
+		{
+			x0 = 0;
+			wx = 0.0f;
+		}
+		int x1 = std::min(x0 + 1, src.width - 1);
+		if (x0 >= src.width - 1)
+		{
+			x0 = x1 = src.width - 1;
+			wx = 0.0f;
+		}
+		x_offset[dx * 2] = x0 * 3;
+		x_offset[dx * 2 + 1] = x1 * 3;
+		x_weight[dx] = wx;
+	}
+
+	y_index.resize(dst.height * 2);
+	y_weight.resize(dst.height);
+	const double scale_y = (double)src.height / dst.height;
+	for (int dy = 0; dy < dst.height; ++dy)
+	{
+		double fy = (dy + 0.5) * scale_y - 0.5;
+		int y0 = (int)std::floor(fy);
+		float wy = (float)(fy - y0);
+		if (y0 < 0)
+		{
+			y0 = 0;
+			wy = 0.0f;
+		}
+		int y1 = std::min(y0 + 1, src.height - 1);
+		if (y0 >= src.height - 1)
+		{
+			y0 = y1 = src.height - 1;
+			wy = 0.0f;
+		}
+		y_index[dy * 2] = y0;
+		y_index[dy * 2 + 1] = y1;
+		y_weight[dy] = wy;
+	}
+}
+
+BoxMapping FramePreprocessor::Process(const cv::Mat& frame, cv::Mat& blob, const int index, const bool letterbox)
+{
+	CV_Assert(blob.dims == 4 && blob.type() == CV_32F && blob.size[1] == 3 && index < blob.size[0]);
+	const int in_h = blob.size[2];
+	const int in_w = blob.size[3];
+
+	const cv::Mat* src = &frame;
+	if (frame.type() != CV_8UC3)
+	{
+		cv::cvtColor(frame, bgr, frame.channels() == 4 ? cv::COLOR_BGRA2BGR : cv::COLOR_GRAY2BGR);
+		src = &bgr;
+	}
+
+	cv::Rect content(0, 0, in_w, in_h);
+	BoxMapping mapping = { (float)src->cols, (float)src->rows, 0.0f, 0.0f };
+	if (letterbox)
+	{
+		double scale = std::min((double)in_w / src->cols, (double)in_h / src->rows);
+		content.width = std::max((int)std::lround(src->cols * scale), 1);
+		content.height = std::max((int)std::lround(src->rows * scale), 1);
+		content.x = (in_w - content.width) / 2;
+		content.y = (in_h - content.height) / 2;
+		mapping.scale_x = (float)(in_w / scale);
+		mapping.scale_y = (float)(in_h / scale);
+		mapping.offset_x = (float)(-content.x / scale);
+		mapping.offset_y = (float)(-content.y / scale);
+	}
+	BuildTables(src->size(), content);
+
+	const float norm = 1.0f / 255.0f;
+	const size_t plane_size = (size_t)in_h * in_w;
+	float* plane_r = blob.ptr<float>(index);
+	float* plane_g = plane_r + plane_size;
+	float* plane_b = plane_g + plane_size;
+
+	if (letterbox && content.size() != cv::Size(in_w, in_h))
+	{
+		std::fill(plane_r, plane_r + plane_size * 3, 0.5f);
+	}
+
+	const int* xo = x_offset.data();
+	const float* xw = x_weight.data();
+	for (int dy = 0; dy < content.height; ++dy)
+	{
+		const uchar* row0 = src->ptr<uchar>(y_index[dy * 2]);
+		const uchar* row1 = src->ptr<uchar>(y_index[dy * 2 + 1]);
+		const float wy = y_weight[dy];
+		const size_t out = (size_t)(content.y + dy) * in_w + content.x;
+		float* out_r = plane_r + out;
+		float* out_g = plane_g + out;
+		float* out_b = plane_b + out;
+
+		for (int dx = 0; dx < content.width; ++dx)
+		{
+			const uchar* p00 = row0 + xo[dx * 2];
+			const uchar* p01 = row0 + xo[dx * 2 + 1];
+			const uchar* p10 = row1 + xo[dx * 2];
+			const uchar* p11 = row1 + xo[dx * 2 + 1];
+			const float wx = xw[dx];
+			const float w00 = (1.0f - wx) * (1.0f - wy) * norm;
+			const float w01 = wx * (1.0f - wy) * norm;
+			const float w10 = (1.0f - wx) * wy * norm;
+			const float w11 = wx * wy * norm;
+			out_b[dx] = p00[0] * w00 + p01[0] * w01 + p10[0] * w10 + p11[0] * w11;
+			out_g[dx] = p00[1] * w00 + p01[1] * w01 + p10[1] * w10 + p11[1] * w11;
+			out_r[dx] = p00[2] * w00 + p01[2] * w01 + p10[2] * w10 + p11[2] * w11;
+		}
+	}
+
+	return mapping;
+}
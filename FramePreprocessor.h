@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "YoloDecoder.h"
+
+//Turns a BGR frame into one image of an NCHW network input blob in a single
+//pass: bilinear resize, BGR to RGB, scaling to 0-1 and the interleaved to
+//planar transpose all happen as each output pixel is written. Nothing is
+//allocated per frame. The interpolation tables are rebuilt only when the
+//frame or input size changes.
+//
+//With letterboxing the frame keeps its aspect ratio and the unused border is
+//filled with mid grey, the way Darknet letterboxes. Otherwise the frame is
+//stretched to the input size, as blobFromImage does.
+class FramePreprocessor
+{
+public:
+	//Writes frame into image index of blob, which must already be a CV_32F
+	//[N x 3 x H x W] blob where H x W is the network input size. Returns the
+	//mapping from the network's normalized box coordinates back to frame pixels.
+	BoxMapping Process(const cv::Mat& frame, cv::Mat& blob, const int index, const bool letterbox);
+
+	//Makes sure blob can hold batch_size images of input_size and returns a
+	//header over the first batch_size images. Only grows the allocation.
+	static cv::Mat PrepareBlob(cv::Mat& storage, const int batch_size, const cv::Size input_size);
+
+private:
+	cv::Size table_src;
+	cv::Rect table_dst;
+	std::vector<int> x_offset;
+	std::vector<float> x_weight;
+	std::vector<int> y_index;
+	std::vector<float> y_weight;
+	cv::Mat bgr;
+
+	void BuildTables(const cv::Size src, const cv::Rect dst);
+};
@@ -1,11 +1,28 @@
 #pragma once
 #include <opencv2/opencv.hpp>
 #include <Poco/RefCountedObject.h>
+#include <Poco/AutoPtr.h>
+#include <Poco/Timestamp.h>
+#include "FrameHistory.h"
 
 class FrameSource : public Poco::RefCountedObject
 {
 public:
-	virtual cv::Mat GetNextFrame(const int wait_ms = 100) = 0;
+	//captured is set to when the frame was read from the source, which may be well before it is returned.
+	virtual cv::Mat GetNextFrame(Poco::Timestamp& captured, const int wait_ms = 100) = 0;
 	virtual void start() = 0;
 	virtual void stop() = 0;
+	//True when frames cost nothing until GetNextFrame asks for one, so callers
+	//should only ask when they will use the frame.
+	virtual bool DecodesOnDemand() const { return false; }
+	//Frames come out this many times smaller than the source in each dimension.
+	virtual int DecodeScale() const { return 1; }
+	//True when GetNextFrame decodes on the calling thread rather than a thread of the source's own.
+	virtual bool DecodesOnCallingThread() const { return false; }
+
+	//Frames are sampled into the history as they are read. Set before start().
+	void SetHistory(Poco::AutoPtr<FrameHistory> frame_history) { history = frame_history; }
+
+protected:
+	Poco::AutoPtr<FrameHistory> history;
 };
\ No newline at end of file
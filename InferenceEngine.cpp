@@ -0,0 +1,42 @@
+#include "InferenceEngine.h"
+#include "OpenCvEngine.h"
+#ifdef OD_WITH_ONNXRUNTIME
+#include "OnnxRuntimeEngine.h"
+#endif
+
+#include <Poco/Exception.h>
+#include <Poco/String.h>
+#include <Poco/Timestamp.h>
+
+
+void InferenceEngine::Forward(const cv::Mat& blob, std::vector<cv::Mat>& outputs)
+{
+	Poco::Timestamp timer;
+	DoForward(blob, outputs);
+	timings.forward_us += timer.elapsed();
+	timings.forwards++;
+	timings.images += (uint64_t)blob.size[0];
+}
+
+InferenceEngine* InferenceEngine::Create(const std::string& engine_name, const ModelSpec& model, const Options& options)
+{
+	const std::string name = Poco::toLower(engine_name);
+	Poco::Timestamp timer;
+	InferenceEngine* engine = nullptr;
+	if (name.empty() || name == "opencv")
+	{
+		engine = new OpenCvEngine(model, options);
+	}
+#ifdef OD_WITH_ONNXRUNTIME
+	else if (name == "onnxruntime")
+	{
+		engine = new OnnxRuntimeEngine(model, options);
+	}
+#endif
+	else
+	{
+		throw Poco::InvalidArgumentException("Unknown inference engine", engine_name);
+	}
+	engine->timings.load_us = timer.elapsed();
+	return engine;
+}
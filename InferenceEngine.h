@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cinttypes>
+
+#include <opencv2/core.hpp>
+
+#include "ModelRegistry.h"
+
+//One model loaded into one inference runtime. The detector only ever talks
+//to this interface, so a runtime can be swapped with detector.engine without
+//anything above the detector knowing. An engine belongs to a single worker
+//and is never run from two threads at once.
+class InferenceEngine
+{
+public:
+	struct Options
+	{
+		std::string backend_name;
+		std::string target_name;
+		//Threads a runtime may use for one forward. 0 leaves it to the runtime.
+		int threads = 0;
+	};
+
+	struct Timings
+	{
+		int64_t load_us = 0;
+		uint64_t forwards = 0;
+		uint64_t images = 0;
+		int64_t forward_us = 0;
+	};
+
+	virtual ~InferenceEngine() {}
+
+	virtual std::string Name() const = 0;
+
+	//blob is a CV_32F NCHW batch of RGB images scaled to 0-1, as FramePreprocessor
+	//produces. Each output is the raw YOLO rows, either [rows x cols] for a single
+	//image or [batch x rows x cols].
+	void Forward(const cv::Mat& blob, std::vector<cv::Mat>& outputs);
+
+	const Timings& GetTimings() const { return timings; }
+	//Forgets the forwards run so far, Ex. warm-up runs, keeping the load time.
+	void ResetForwardTimings() { timings = Timings{ timings.load_us }; }
+
+	//engine_name is "opencv" or, when built with OD_WITH_ONNXRUNTIME, "onnxruntime".
+	//Throws Poco::InvalidArgumentException for an unknown engine or a model the
+	//engine cannot load.
+	static InferenceEngine* Create(const std::string& engine_name, const ModelSpec& model, const Options& options);
+
+protected:
+	Timings timings;
+
+	virtual void DoForward(const cv::Mat& blob, std::vector<cv::Mat>& outputs) = 0;
+};
@@ -0,0 +1,217 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <cinttypes>
+
+#include <Poco/Timestamp.h>
+
+struct SourceQueueStats
+{
+	size_t queued = 0;
+	uint64_t scheduled = 0;
+	uint64_t superseded = 0;
+	uint64_t cancelled = 0;
+	uint64_t dropped = 0;
+	uint64_t rejected = 0;
+	int64_t total_wait_us = 0;
+	int64_t max_wait_us = 0;
+};
+
+//Orders queued jobs across sources. Sources in a higher priority class always
+//go first. Within a class, sources share the workers in proportion to their
+//weight by weighted fair queueing: each job is stamped with a virtual finish
+//time cost / weight past the later of its source's previous stamp and the
+//stamp of the job last taken, and the earliest stamp runs next. A source that
+//floods the queue only pushes its own stamps further out, and an idle source
+//cannot bank credit.
+//
+//A job still queued past its source's deadline is superseded as soon as a
+//newer job from the same source is queued, since nobody wants the older frame.
+//The owner decides what to admit and drops jobs through DropOldest.
+//
+//Not thread safe. Job must have a uint64_t job_id.
+template <typename Job>
+class JobScheduler
+{
+public:
+	//deadline_us of 0 means jobs never go stale.
+	void ConfigureSource(const std::string& src_name, const int priority, const double weight, const Poco::Timestamp::TimeDiff deadline_us)
+	{
+		Source& source = sources[src_name];
+		source.priority = priority;
+		source.weight = weight > 0.0 ? weight : 1.0;
+		source.deadline_us = deadline_us;
+	}
+
+	//Overdue jobs of the same source are moved to superseded.
+	void Push(const std::string& src_name, const Job& job, const double cost, std::vector<Job>& superseded)
+	{
+		Source& source = sources[src_name];
+		if (source.deadline_us > 0)
+		{
+			for (auto it = source.entries.begin(); it != source.entries.end(); )
+			{
+				if (!it->queued.isElapsed(source.deadline_us))
+				{
+					++it;
+					continue;
+				}
+				superseded.push_back(it->job);
+				source.stats.superseded++;
+				it = source.entries.erase(it);
+				--queued;
+			}
+		}
+
+		Entry entry = { job, Poco::Timestamp(), 0.0 };
+		entry.finish = std::max(virtual_time, source.last_finish) + cost / source.weight;
+		source.last_finish = entry.finish;
+		source.entries.push_back(entry);
+		++queued;
+	}
+
+	//Takes the job with the earliest stamp that accept(job) allows.
+	template <typename Accept>
+	bool Pop(Job& job, Accept accept)
+	{
+		Source* best_source = nullptr;
+		typename std::deque<Entry>::iterator best;
+		for (auto& [name, source] : sources)
+		{
+			auto it = std::find_if(source.entries.begin(), source.entries.end(), [&](const Entry& entry) { return accept(entry.job); });
+			if (it == source.entries.end()) continue;
+			if (best_source == nullptr || source.priority > best_source->priority ||
+				(source.priority == best_source->priority && it->finish < best->finish))
+			{
+				best_source = &source;
+				best = it;
+			}
+		}
+		if (best_source == nullptr) return false;
+
+		job = best->job;
+		virtual_time = std::max(virtual_time, best->finish);
+		int64_t wait_us = best->queued.elapsed();
+		SourceQueueStats& stats = best_source->stats;
+		stats.scheduled++;
+		stats.total_wait_us += wait_us;
+		stats.max_wait_us = std::max(stats.max_wait_us, wait_us);
+		best_source->entries.erase(best);
+		--queued;
+		return true;
+	}
+
+	bool Cancel(const uint64_t job_id, Job& job)
+	{
+		for (auto& [name, source] : sources)
+		{
+			for (auto it = source.entries.begin(); it != source.entries.end(); ++it)
+			{
+				if (it->job.job_id != job_id) continue;
+				job = it->job;
+				source.stats.cancelled++;
+				source.entries.erase(it);
+				--queued;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//Removes the source's oldest queued job, or with no source given the oldest
+	//job of the source with the most queued.
+	bool DropOldest(const std::string& src_name, Job& job)
+	{
+		Source* victim = nullptr;
+		if (!src_name.empty())
+		{
+			auto it = sources.find(src_name);
+			if (it != sources.end()) victim = &it->second;
+		}
+		else
+		{
+			for (auto& [name, source] : sources)
+			{
+				if (victim == nullptr || source.entries.size() > victim->entries.size()) victim = &source;
+			}
+		}
+		if (victim == nullptr || victim->entries.empty()) return false;
+
+		job = victim->entries.front().job;
+		victim->stats.dropped++;
+		victim->entries.pop_front();
+		--queued;
+		return true;
+	}
+
+	void CountRejected(const std::string& src_name)
+	{
+		sources[src_name].stats.rejected++;
+	}
+
+	//True while the job is queued past its source's deadline, so the next job
+	//from that source will supersede it.
+	bool IsOverdue(const uint64_t job_id) const
+	{
+		for (const auto& [name, source] : sources)
+		{
+			for (const auto& entry : source.entries)
+			{
+				if (entry.job.job_id == job_id) return source.deadline_us > 0 && entry.queued.isElapsed(source.deadline_us);
+			}
+		}
+		return false;
+	}
+
+	//Adds up measure(job) over every queued job.
+	template <typename Measure>
+	size_t Sum(Measure measure) const
+	{
+		size_t total = 0;
+		for (const auto& [name, source] : sources)
+		{
+			for (const auto& entry : source.entries) total += measure(entry.job);
+		}
+		return total;
+	}
+
+	bool empty() const { return queued == 0; }
+	size_t size() const { return queued; }
+
+	std::map<std::string, SourceQueueStats> Stats() const
+	{
+		std::map<std::string, SourceQueueStats> stats;
+		for (const auto& [name, source] : sources)
+		{
+			SourceQueueStats& source_stats = stats[name];
+			source_stats = source.stats;
+			source_stats.queued = source.entries.size();
+		}
+		return stats;
+	}
+
+private:
+	struct Entry
+	{
+		Job job;
+		Poco::Timestamp queued;
+		double finish;
+	};
+
+	struct Source
+	{
+		int priority = 0;
+		double weight = 1.0;
+		Poco::Timestamp::TimeDiff deadline_us = 0;
+		double last_finish = 0.0;
+		std::deque<Entry> entries;
+		SourceQueueStats stats;
+	};
+
+	std::map<std::string, Source> sources;
+	double virtual_time = 0.0;
+	size_t queued = 0;
+};
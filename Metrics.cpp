@@ -0,0 +1,124 @@
+#include "Metrics.h"
+
+#include <Poco/Exception.h>
+
+#include <iomanip>
+
+
+const int64_t LatencyHistogram::bucket_bounds_us[LatencyHistogram::bucket_count] =
+{
+	100, 250, 500,
+	1000, 2500, 5000,
+	10000, 25000, 50000,
+	100000, 250000, 500000,
+	1000000, 2500000, 5000000,
+	10000000
+};
+
+LatencyHistogram::LatencyHistogram() :
+	sum_us(0)
+{
+	for (auto& count : counts) count.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Observe(const int64_t us)
+{
+	int bucket = 0;
+	while (bucket < bucket_count && us > bucket_bounds_us[bucket]) ++bucket;
+	counts[bucket].fetch_add(1, std::memory_order_relaxed);
+	sum_us.fetch_add(us, std::memory_order_relaxed);
+}
+
+//Buckets are read one at a time, so a scrape racing an Observe may see the
+//count and the sum one observation apart. Prometheus tolerates that.
+void LatencyHistogram::Read(uint64_t (&bucket_counts)[bucket_count + 1], int64_t& total_us) const
+{
+	for (int b = 0; b <= bucket_count; ++b) bucket_counts[b] = counts[b].load(std::memory_order_relaxed);
+	total_us = sum_us.load(std::memory_order_relaxed);
+}
+
+
+Metrics& Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+std::string Metrics::Label(const std::string& label, const std::string& label_value)
+{
+	std::string escaped;
+	for (char c : label_value)
+	{
+		if (c == '\\' || c == '"') escaped += '\\';
+		if (c == '\n') escaped += "\\n";
+		else escaped += c;
+	}
+	return label + "=\"" + escaped + "\"";
+}
+
+LatencyHistogram& Metrics::Histogram(const std::string& name, const std::string& help, const std::string& label, const std::string& label_value)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_families);
+	Family& family = families[name];
+	if (family.help.empty())
+	{
+		family.help = help;
+		family.is_histogram = true;
+	}
+	else if (!family.is_histogram)
+	{
+		throw Poco::InvalidArgumentException("Metric is not a histogram", name);
+	}
+	Poco::SharedPtr<LatencyHistogram>& histogram = family.histograms[Label(label, label_value)];
+	if (histogram.isNull()) histogram = new LatencyHistogram;
+	return *histogram;
+}
+
+MetricGauge& Metrics::Gauge(const std::string& name, const std::string& help, const std::string& label, const std::string& label_value)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_families);
+	Family& family = families[name];
+	if (family.help.empty())
+	{
+		family.help = help;
+		family.is_histogram = false;
+	}
+	else if (family.is_histogram)
+	{
+		throw Poco::InvalidArgumentException("Metric is not a gauge", name);
+	}
+	Poco::SharedPtr<MetricGauge>& gauge = family.gauges[Label(label, label_value)];
+	if (gauge.isNull()) gauge = new MetricGauge;
+	return *gauge;
+}
+
+void Metrics::Render(std::ostream& out)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_families);
+	out << std::fixed << std::setprecision(6);
+	for (const auto& [name, family] : families)
+	{
+		out << "# HELP " << name << " " << family.help << "\n";
+		out << "# TYPE " << name << (family.is_histogram ? " histogram" : " gauge") << "\n";
+		for (const auto& [labels, gauge] : family.gauges)
+		{
+			out << name << "{" << labels << "} " << gauge->Get() << "\n";
+		}
+		for (const auto& [labels, histogram] : family.histograms)
+		{
+			uint64_t counts[LatencyHistogram::bucket_count + 1];
+			int64_t sum_us;
+			histogram->Read(counts, sum_us);
+			uint64_t cumulative = 0;
+			for (int b = 0; b < LatencyHistogram::bucket_count; ++b)
+			{
+				cumulative += counts[b];
+				out << name << "_bucket{" << labels << ",le=\"" << LatencyHistogram::bucket_bounds_us[b] / 1000000.0 << "\"} " << cumulative << "\n";
+			}
+			cumulative += counts[LatencyHistogram::bucket_count];
+			out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << cumulative << "\n";
+			out << name << "_sum{" << labels << "} " << sum_us / 1000000.0 << "\n";
+			out << name << "_count{" << labels << "} " << cumulative << "\n";
+		}
+	}
+}
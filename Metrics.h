@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <map>
+#include <atomic>
+#include <ostream>
+#include <cinttypes>
+
+#include <Poco/Mutex.h>
+#include <Poco/SharedPtr.h>
+
+//Latency distribution with fixed buckets from 100 us to 10 s. Observe is a
+//couple of relaxed atomic adds, safe from any thread and cheap enough to leave
+//on in every stage of the pipeline whether or not anyone is scraping.
+class LatencyHistogram
+{
+public:
+	static const int bucket_count = 16;
+	//Upper bound of each bucket. Slower observations land in a final +Inf bucket.
+	static const int64_t bucket_bounds_us[bucket_count];
+
+	LatencyHistogram();
+
+	void Observe(const int64_t us);
+
+	//Counts per bucket, not cumulative, with +Inf last.
+	void Read(uint64_t (&counts)[bucket_count + 1], int64_t& sum_us) const;
+
+private:
+	std::atomic<uint64_t> counts[bucket_count + 1];
+	std::atomic<int64_t> sum_us;
+};
+
+class MetricGauge
+{
+public:
+	MetricGauge() : value(0) {}
+	void Set(const int64_t new_value) { value.store(new_value, std::memory_order_relaxed); }
+	int64_t Get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<int64_t> value;
+};
+
+//Every histogram and gauge in the process, by metric name and one label.
+//Looking a metric up takes a lock, so callers look theirs up once and keep
+//the reference, which stays valid for the life of the process. Render writes
+//them all out in the Prometheus text exposition format.
+class Metrics
+{
+public:
+	static Metrics& instance();
+
+	LatencyHistogram& Histogram(const std::string& name, const std::string& help, const std::string& label, const std::string& label_value);
+	MetricGauge& Gauge(const std::string& name, const std::string& help, const std::string& label, const std::string& label_value);
+
+	void Render(std::ostream& out);
+
+private:
+	Metrics() {}
+
+	struct Family
+	{
+		std::string help;
+		bool is_histogram;
+		//By the rendered label pair, Ex. camera="front".
+		std::map<std::string, Poco::SharedPtr<LatencyHistogram>> histograms;
+		std::map<std::string, Poco::SharedPtr<MetricGauge>> gauges;
+	};
+	Poco::Mutex mu_families;
+	std::map<std::string, Family> families;
+
+	static std::string Label(const std::string& label, const std::string& label_value);
+};
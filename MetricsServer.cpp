@@ -0,0 +1,77 @@
+#include "MetricsServer.h"
+#include "Metrics.h"
+
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/SocketAddress.h>
+
+#include <sstream>
+
+using namespace Poco::Net;
+
+
+class MetricsRequestHandler : public HTTPRequestHandler
+{
+public:
+	void handleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override
+	{
+		if (request.getURI() != "/metrics")
+		{
+			response.setStatusAndReason(HTTPResponse::HTTP_NOT_FOUND);
+			response.send();
+			return;
+		}
+
+		std::stringstream body;
+		Metrics::instance().Render(body);
+		const std::string text = body.str();
+		response.setContentType("text/plain; version=0.0.4");
+		response.sendBuffer(text.data(), text.size());
+	}
+};
+
+class MetricsRequestHandlerFactory : public HTTPRequestHandlerFactory
+{
+public:
+	HTTPRequestHandler* createRequestHandler(const HTTPServerRequest& request) override
+	{
+		return new MetricsRequestHandler;
+	}
+};
+
+
+MetricsServer::MetricsServer(const Poco::Util::AbstractConfiguration& config) :
+	log(Poco::Logger::get("Metrics"))
+{
+	address = config.getString("metrics.address", "127.0.0.1");
+	port = (unsigned short)config.getUInt("metrics.port", 0);
+}
+
+MetricsServer::~MetricsServer()
+{
+	stop();
+}
+
+void MetricsServer::start()
+{
+	if (!isEnabled() || !server.isNull()) return;
+
+	//One scrape at a time is plenty and keeps the server from competing with detection.
+	HTTPServerParams::Ptr params = new HTTPServerParams;
+	params->setMaxThreads(1);
+	params->setMaxQueued(4);
+	server = new HTTPServer(new MetricsRequestHandlerFactory, ServerSocket(SocketAddress(address, port)), params);
+	server->start();
+	log.information("Serving metrics at http://" + address + ":" + std::to_string(port) + "/metrics");
+}
+
+void MetricsServer::stop()
+{
+	if (server.isNull()) return;
+	server->stopAll();
+	server.reset();
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+
+#include <Poco/Logger.h>
+#include <Poco/SharedPtr.h>
+#include <Poco/Net/HTTPServer.h>
+#include <Poco/Util/AbstractConfiguration.h>
+
+//Serves Metrics at /metrics for Prometheus to scrape. Nothing is rendered
+//until a scrape arrives. Listens on metrics.address (loopback by default)
+//and metrics.port. Port 0 leaves the server off.
+class MetricsServer
+{
+public:
+	MetricsServer(const Poco::Util::AbstractConfiguration& config);
+	~MetricsServer();
+
+	bool isEnabled() const { return port != 0; }
+
+	void start();
+	void stop();
+
+private:
+	Poco::Logger& log;
+	std::string address;
+	unsigned short port;
+	Poco::SharedPtr<Poco::Net::HTTPServer> server;
+};
@@ -0,0 +1,241 @@
+//Microbenchmarks for the detection post-processing stages. They run on
+//synthetic network output so no model, camera or configuration is needed.
+
+#include <Poco/Timestamp.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+
+#include <iostream>
+#include <map>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "YoloDecoder.h"
+#include "ClassAwareNms.h"
+
+using namespace std;
+using namespace cv;
+
+
+//Region layer output for one input size. Most rows have near zero objectness,
+//a few percent carry an object, and class scores below the region layer's
+//threshold are zero just like OpenCV produces them.
+static vector<Mat> MakeRegionOutputs(const int input_size, const int num_classes, const unsigned seed)
+{
+	mt19937 rng(seed);
+	uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	vector<Mat> outputs;
+	for (int stride : { 32, 16, 8 })
+	{
+		int cells = input_size / stride;
+		Mat output(cells * cells * 3, num_classes + 5, CV_32F);
+		for (int r = 0; r < output.rows; ++r)
+		{
+			float* row = output.ptr<float>(r);
+			row[0] = unit(rng);
+			row[1] = unit(rng);
+			row[2] = unit(rng) * 0.3f;
+			row[3] = unit(rng) * 0.3f;
+			row[4] = unit(rng) < 0.02f ? unit(rng) : unit(rng) * 0.01f;
+			for (int c = 0; c < num_classes; ++c)
+			{
+				float score = row[4] * unit(rng);
+				row[5 + c] = score > 0.24f ? score : 0.0f;
+			}
+		}
+		outputs.push_back(output);
+	}
+	return outputs;
+}
+
+//The decode loop Detector used before YoloDecoder.
+static void ReferenceDecode(const vector<Mat>& outputs, const Size frame_size, const float confidence_threshold,
+	vector<int>& classIds, vector<float>& confidences, vector<Rect>& boxes)
+{
+	for (auto detection : outputs)
+	{
+		float* data = (float*)detection.data;
+		for (int j = 0; j < detection.rows; ++j, data += detection.cols)
+		{
+			Mat scores = detection.row(j).colRange(5, detection.cols);
+			Point classIdPoint;
+			double confidence;
+			minMaxLoc(scores, 0, &confidence, 0, &classIdPoint);
+			if (confidence > confidence_threshold)
+			{
+				int centerX = (int)(data[0] * frame_size.width);
+				int centerY = (int)(data[1] * frame_size.height);
+				int width = (int)(data[2] * frame_size.width);
+				int height = (int)(data[3] * frame_size.height);
+				classIds.push_back(classIdPoint.x);
+				confidences.push_back((float)confidence);
+				boxes.push_back(Rect(centerX - width / 2, centerY - height / 2, width, height));
+			}
+		}
+	}
+}
+
+static void BenchmarkDecode(const int input_size, const int iterations)
+{
+	const float confidence_threshold = 0.35f;
+	const Size frame_size(1920, 1080);
+	vector<Mat> outputs = MakeRegionOutputs(input_size, 80, input_size);
+	int total_rows = 0;
+	for (const auto& output : outputs) total_rows += output.rows;
+
+	vector<int> classIds;
+	vector<float> confidences;
+	vector<Rect> boxes;
+	Poco::Timestamp timer;
+	for (int i = 0; i < iterations; ++i)
+	{
+		classIds.clear();
+		confidences.clear();
+		boxes.clear();
+		ReferenceDecode(outputs, frame_size, confidence_threshold, classIds, confidences, boxes);
+	}
+	double reference_us = (double)timer.elapsed() / iterations;
+
+	BoxMapping mapping = { (float)frame_size.width, (float)frame_size.height, 0.0f, 0.0f };
+	DetectionCandidates scalar;
+	timer.update();
+	for (int i = 0; i < iterations; ++i)
+	{
+		scalar.clear();
+		for (const auto& output : outputs)
+			YoloDecoder::DecodeScalar(output.ptr<float>(), output.rows, output.cols, confidence_threshold, mapping, scalar);
+	}
+	double scalar_us = (double)timer.elapsed() / iterations;
+
+	DetectionCandidates candidates;
+	timer.update();
+	for (int i = 0; i < iterations; ++i)
+	{
+		candidates.clear();
+		for (const auto& output : outputs)
+			YoloDecoder::Decode(output.ptr<float>(), output.rows, output.cols, confidence_threshold, mapping, candidates);
+	}
+	double decoder_us = (double)timer.elapsed() / iterations;
+
+	bool same = candidates.size() == boxes.size();
+	for (size_t i = 0; same && i < candidates.size(); ++i)
+	{
+		same = candidates.class_id[i] == classIds[i] && candidates.confidence[i] == confidences[i] &&
+			Rect(candidates.left[i], candidates.top[i], candidates.width[i], candidates.height[i]) == boxes[i];
+	}
+
+	cout << "decode " << input_size << "x" << input_size << " (" << total_rows << " rows, " << candidates.size() << " kept)" << endl;
+	cout << fixed << setprecision(1);
+	cout << "  minMaxLoc   " << setw(9) << reference_us << " us" << endl;
+	cout << "  scalar      " << setw(9) << scalar_us << " us" << endl;
+	cout << "  vectorized  " << setw(9) << decoder_us << " us  (" << setprecision(2) << reference_us / decoder_us << "x)" << endl;
+	cout << "  results " << (same ? "match" : "DIFFER") << endl;
+}
+
+//A crowded scene: objects scattered over a 4K frame, each proposed many times
+//with jittered boxes and scores the way neighbouring anchors propose it.
+static DetectionCandidates MakeCandidates(const int num_candidates, const int num_classes, const unsigned seed)
+{
+	mt19937 rng(seed);
+	uniform_int_distribution<int> jitter(-12, 12);
+	uniform_real_distribution<float> score(0.30f, 1.0f);
+
+	DetectionCandidates candidates;
+	const int proposals_per_object = 12;
+	for (int n = 0; n < num_candidates; n += proposals_per_object)
+	{
+		int cls = (int)(rng() % num_classes);
+		int x = (int)(rng() % 3700);
+		int y = (int)(rng() % 2000);
+		int w = 40 + (int)(rng() % 120);
+		int h = 60 + (int)(rng() % 160);
+		for (int p = 0; p < proposals_per_object && n + p < num_candidates; ++p)
+		{
+			candidates.push_back(x + jitter(rng), y + jitter(rng), w + jitter(rng), h + jitter(rng), score(rng), cls);
+		}
+	}
+	return candidates;
+}
+
+//The per class copy and NMSBoxes loop Detector used before ClassAwareNms.
+static void ReferenceNms(const DetectionCandidates& candidates, const float confidence_threshold, const float nms_threshold, vector<int>& keep)
+{
+	map<int, vector<size_t> > class2indices;
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		if (candidates.confidence[i] >= confidence_threshold)
+		{
+			class2indices[candidates.class_id[i]].push_back(i);
+		}
+	}
+	for (auto it = class2indices.begin(); it != class2indices.end(); ++it)
+	{
+		vector<Rect> localBoxes;
+		vector<float> localConfidences;
+		vector<size_t> classIndices = it->second;
+		for (size_t i = 0; i < classIndices.size(); i++)
+		{
+			size_t c = classIndices[i];
+			localBoxes.push_back(Rect(candidates.left[c], candidates.top[c], candidates.width[c], candidates.height[c]));
+			localConfidences.push_back(candidates.confidence[c]);
+		}
+		vector<int> nmsIndices;
+		dnn::NMSBoxes(localBoxes, localConfidences, confidence_threshold, nms_threshold, nmsIndices);
+		for (size_t i = 0; i < nmsIndices.size(); i++)
+		{
+			keep.push_back((int)classIndices[nmsIndices[i]]);
+		}
+	}
+}
+
+static void BenchmarkNms(const int num_candidates, const int iterations)
+{
+	const float confidence_threshold = 0.35f;
+	const float nms_threshold = 0.48f;
+	DetectionCandidates candidates = MakeCandidates(num_candidates, 6, num_candidates);
+
+	vector<int> reference_keep;
+	Poco::Timestamp timer;
+	for (int i = 0; i < iterations; ++i)
+	{
+		reference_keep.clear();
+		ReferenceNms(candidates, confidence_threshold, nms_threshold, reference_keep);
+	}
+	double reference_us = (double)timer.elapsed() / iterations;
+
+	ClassAwareNms nms;
+	vector<int> keep;
+	timer.update();
+	for (int i = 0; i < iterations; ++i)
+	{
+		nms.Run(candidates, confidence_threshold, nms_threshold, keep);
+	}
+	double nms_us = (double)timer.elapsed() / iterations;
+
+	cout << "nms " << num_candidates << " candidates (" << keep.size() << " kept)" << endl;
+	cout << fixed << setprecision(1);
+	cout << "  NMSBoxes    " << setw(9) << reference_us << " us" << endl;
+	cout << "  one pass    " << setw(9) << nms_us << " us  (" << setprecision(2) << reference_us / nms_us << "x)" << endl;
+	cout << "  results " << (keep == reference_keep ? "match" : "DIFFER") << endl;
+}
+
+int main(int argc, char** argv)
+{
+	int iterations = argc > 1 ? max(stoi(argv[1]), 1) : 200;
+
+	for (int input_size : { 320, 416, 608 })
+	{
+		BenchmarkDecode(input_size, iterations);
+	}
+
+	for (int num_candidates : { 100, 1000, 5000 })
+	{
+		BenchmarkNms(num_candidates, iterations);
+	}
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include "ModelRegistry.h"
+
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/String.h>
+
+#include <fstream>
+
+
+ModelRegistry::ModelRegistry(const std::string& model_dir) :
+	model_directory(model_dir)
+{
+}
+
+std::string ModelRegistry::ResolvePath(const std::string& name) const
+{
+	Poco::Path path(name);
+	if (path.isAbsolute()) return path.toString();
+	Poco::Path resolved(Poco::Path::forDirectory(model_directory));
+	resolved.append(path);
+	return resolved.toString();
+}
+
+Poco::SharedPtr<const ModelSpec> ModelRegistry::Resolve(const std::string& config_name, const std::string& weights_name, const std::string& names_name, const int input_size,
+	const std::string& output_layout)
+{
+	ModelSpec::Format format = ModelSpec::Format::Darknet;
+	const std::string extension = Poco::toLower(Poco::Path(weights_name).getExtension());
+	if (extension == "onnx") format = ModelSpec::Format::Onnx;
+	else if (extension == "bin") format = ModelSpec::Format::OpenVino;
+
+	std::string layout = Poco::toLower(output_layout);
+	if (layout.empty()) layout = format == ModelSpec::Format::Darknet ? "region" : "yolov5";
+	if (layout != "region" && layout != "yolov5") throw Poco::InvalidArgumentException("Unknown model output layout", output_layout);
+
+	std::string config_file = format == ModelSpec::Format::Onnx ? "" : ResolvePath(config_name);
+	std::string weights_file = ResolvePath(weights_name);
+	std::string key = config_file + "|" + weights_file + "|" + std::to_string(input_size) + "|" + layout;
+
+	Poco::ScopedLock<Poco::Mutex> locker(mu_models);
+	auto it = models.find(key);
+	if (it != models.end()) return it->second;
+
+	if (!config_file.empty() && !Poco::File(config_file).exists()) throw Poco::FileNotFoundException(config_file);
+	if (!Poco::File(weights_file).exists()) throw Poco::FileNotFoundException(weights_file);
+
+	Poco::SharedPtr<ModelSpec> spec = new ModelSpec;
+	spec->key = key;
+	spec->format = format;
+	spec->normalized_boxes = layout == "region";
+	spec->scores_include_objectness = layout == "region";
+	spec->config_file = config_file;
+	spec->weights_file = weights_file;
+	spec->input_size = cv::Size(input_size, input_size);
+
+	std::string names_file = ResolvePath(names_name);
+	std::ifstream ifs(names_file.c_str());
+	if (!ifs.is_open())
+	{
+		throw Poco::FileNotFoundException("Unable to open " + names_file);
+	}
+	std::string line;
+	while (std::getline(ifs, line))
+	{
+		spec->classes.push_back(line);
+	}
+
+	Poco::SharedPtr<const ModelSpec> model(spec);
+	models[key] = model;
+	return model;
+}
+
+std::vector<Poco::SharedPtr<const ModelSpec>> ModelRegistry::Models() const
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_models);
+	std::vector<Poco::SharedPtr<const ModelSpec>> all;
+	for (const auto& [key, model] : models)
+	{
+		all.push_back(model);
+	}
+	return all;
+}
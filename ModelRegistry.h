@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+
+#include <Poco/Mutex.h>
+#include <Poco/SharedPtr.h>
+
+#include <opencv2/core.hpp>
+
+//Everything needed to run one model: the files to load, the input size to
+//feed it, how to read its output and what its class ids mean. Read only once
+//registered.
+struct ModelSpec
+{
+	//Taken from the weights file extension: .weights is Darknet, .onnx is ONNX
+	//and .bin (with its .xml as the config) is an OpenVINO IR, which is how
+	//INT8 quantized models run on the Inference Engine backend.
+	enum class Format { Darknet, Onnx, OpenVino };
+
+	std::string key;
+	Format format;
+	std::string config_file;
+	std::string weights_file;
+	cv::Size input_size;
+	std::vector<std::string> classes;
+
+	//Either way each output row is (cx, cy, w, h, objectness, class scores...).
+	//OpenCV's Darknet region layers emit boxes normalized to 0-1 with the
+	//objectness already folded into the class scores. Exported models
+	//usually emit boxes in input pixels and leave the class scores unscaled.
+	bool normalized_boxes;
+	bool scores_include_objectness;
+
+	//Identifies the loaded network. Specs that differ only in input size share
+	//one network since OpenCV reshapes it to whatever input it is given.
+	inline std::string NetworkKey() const { return config_file + "|" + weights_file; }
+};
+
+//Every model any camera asks for, keyed by config, weights and input size.
+//Asking twice for the same model returns the same spec, so cameras that
+//name the same files share one model. Registering a model only checks its
+//files and reads its class names. The network itself is loaded by the
+//detector the first time a job needs it.
+class ModelRegistry
+{
+public:
+	//Relative file names are looked up in model_dir.
+	ModelRegistry(const std::string& model_dir);
+
+	//output_layout is "region" for Darknet style rows or "yolov5" for exported
+	//models with pixel boxes. Empty picks by format. ONNX models ignore config_name.
+	Poco::SharedPtr<const ModelSpec> Resolve(const std::string& config_name, const std::string& weights_name, const std::string& names_name, const int input_size,
+		const std::string& output_layout = "");
+
+	std::vector<Poco::SharedPtr<const ModelSpec>> Models() const;
+
+private:
+	std::string model_directory;
+	mutable Poco::Mutex mu_models;
+	std::map<std::string, Poco::SharedPtr<const ModelSpec>> models;
+
+	std::string ResolvePath(const std::string& name) const;
+};
@@ -0,0 +1,263 @@
+//Compares a candidate model, typically an FP16 or INT8 quantized export,
+//against the FP32 reference model it was made from. Both run over a folder
+//of frames from our own cameras. The reference detections are treated as the
+//truth, so the report is the accuracy given up for the speed gained.
+//
+//ModelValidator <frames_dir> <reference_weights> <reference_config> <candidate_weights> <candidate_config|-> [options]
+//  --names <file>       class names (coco.names)
+//  --size <n>           square input size of both models (416)
+//  --output <layout>    candidate output layout, region or yolov5 (picked by format)
+//  --backend <name>     candidate backend, as detector.backend (default)
+//  --target <name>      candidate target, as detector.target (cpu)
+//  --engine <name>      candidate inference engine, as detector.engine (opencv)
+//  --threads <n>        candidate engine threads, as detector.engine_threads (0)
+//  --conf <f>           confidence threshold (0.35)
+//  --nms <f>            NMS threshold (0.48)
+//  --iou <f>            overlap needed for two detections to agree (0.5)
+
+#include <Poco/DirectoryIterator.h>
+#include <Poco/Exception.h>
+#include <Poco/Path.h>
+#include <Poco/String.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ClassAwareNms.h"
+#include "FramePreprocessor.h"
+#include "InferenceEngine.h"
+#include "ModelRegistry.h"
+#include "YoloDecoder.h"
+
+using namespace std;
+using namespace cv;
+
+
+struct Box
+{
+	int class_id;
+	Rect rect;
+	float confidence;
+};
+
+struct ValidatedModel
+{
+	string name;
+	Poco::SharedPtr<const ModelSpec> spec;
+	Poco::SharedPtr<InferenceEngine> engine;
+	FramePreprocessor preprocessor;
+	Mat input_storage;
+	DetectionCandidates candidates;
+	ClassAwareNms nms;
+	vector<int> kept;
+};
+
+struct ClassAgreement
+{
+	int reference = 0;
+	int candidate = 0;
+	int matched = 0;
+	double iou_sum = 0.0;
+	double confidence_delta_sum = 0.0;
+};
+
+static void Load(ValidatedModel& model, const string& engine_name, const InferenceEngine::Options& options)
+{
+	model.engine = InferenceEngine::Create(engine_name, *model.spec, options);
+	cout << model.name << ": " << model.spec->weights_file << " loaded on " << model.engine->Name() << " in "
+		<< model.engine->GetTimings().load_us / 1000 << " ms" << endl;
+}
+
+//The same decode the detector does for a single untiled frame.
+static vector<Box> Detect(ValidatedModel& model, const Mat& frame, const float confidence_threshold, const float nms_threshold)
+{
+	const ModelSpec& spec = *model.spec;
+	Mat blob = FramePreprocessor::PrepareBlob(model.input_storage, 1, spec.input_size);
+	BoxMapping mapping = model.preprocessor.Process(frame, blob, 0, false);
+	if (!spec.normalized_boxes)
+	{
+		mapping.scale_x /= (float)spec.input_size.width;
+		mapping.scale_y /= (float)spec.input_size.height;
+	}
+
+	vector<Mat> outputs;
+	model.engine->Forward(blob, outputs);
+
+	model.candidates.clear();
+	for (const auto& output : outputs)
+	{
+		CV_Assert(output.type() == CV_32F && output.isContinuous());
+		//Only one image per forward here, so a 3D output has only the first plane.
+		const int rows = output.dims == 3 ? output.size[1] : output.rows;
+		const int cols = output.dims == 3 ? output.size[2] : output.cols;
+		YoloDecoder::Decode(output.ptr<float>(), rows, cols, confidence_threshold, mapping, model.candidates, !spec.scores_include_objectness);
+	}
+	model.nms.Run(model.candidates, confidence_threshold, nms_threshold, model.kept);
+
+	vector<Box> boxes;
+	for (int idx : model.kept)
+	{
+		const DetectionCandidates& c = model.candidates;
+		Box box = { c.class_id[idx], Rect(c.left[idx], c.top[idx], c.width[idx], c.height[idx]), c.confidence[idx] };
+		boxes.push_back(box);
+	}
+	return boxes;
+}
+
+static double IoU(const Rect& a, const Rect& b)
+{
+	double intersection = (a & b).area();
+	double united = (double)a.area() + (double)b.area() - intersection;
+	return united > 0.0 ? intersection / united : 0.0;
+}
+
+//Greedy matching, most confident candidate first, within the same class.
+static void Compare(const vector<Box>& reference, vector<Box> candidate, const double iou_threshold, map<int, ClassAgreement>& agreement)
+{
+	sort(candidate.begin(), candidate.end(), [](const Box& a, const Box& b) { return a.confidence > b.confidence; });
+	vector<bool> used(reference.size(), false);
+	for (const auto& box : reference) ++agreement[box.class_id].reference;
+	for (const auto& box : candidate)
+	{
+		ClassAgreement& stats = agreement[box.class_id];
+		++stats.candidate;
+		int best = -1;
+		double best_iou = iou_threshold;
+		for (size_t r = 0; r < reference.size(); ++r)
+		{
+			if (used[r] || reference[r].class_id != box.class_id) continue;
+			double iou = IoU(reference[r].rect, box.rect);
+			if (iou >= best_iou)
+			{
+				best_iou = iou;
+				best = (int)r;
+			}
+		}
+		if (best < 0) continue;
+		used[best] = true;
+		++stats.matched;
+		stats.iou_sum += best_iou;
+		stats.confidence_delta_sum += box.confidence - reference[best].confidence;
+	}
+}
+
+static void PrintRow(const string& name, const ClassAgreement& s)
+{
+	double recall = s.reference ? (double)s.matched / s.reference : 1.0;
+	double precision = s.candidate ? (double)s.matched / s.candidate : 1.0;
+	cout << left << setw(16) << name << right << setw(8) << s.reference << setw(8) << s.candidate
+		<< setw(9) << setprecision(3) << recall << setw(10) << precision
+		<< setw(9) << (s.matched ? s.iou_sum / s.matched : 0.0)
+		<< setw(10) << showpos << (s.matched ? s.confidence_delta_sum / s.matched : 0.0) << noshowpos << endl;
+}
+
+int main(int argc, char** argv)
+{
+	vector<string> positional;
+	map<string, string> options;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (arg.compare(0, 2, "--") == 0 && i + 1 < argc) options[arg.substr(2)] = argv[++i];
+		else positional.push_back(arg);
+	}
+	if (positional.size() != 5)
+	{
+		cerr << "ModelValidator <frames_dir> <reference_weights> <reference_config> <candidate_weights> <candidate_config|-> [options]" << endl;
+		return 1;
+	}
+	auto option = [&](const string& key, const string& fallback) { return options.count(key) ? options[key] : fallback; };
+
+	try
+	{
+		const int input_size = stoi(option("size", "416"));
+		const float confidence_threshold = stof(option("conf", "0.35"));
+		const float nms_threshold = stof(option("nms", "0.48"));
+		const double iou_threshold = stod(option("iou", "0.5"));
+		const string names = option("names", "coco.names");
+
+		ModelRegistry registry(Poco::Path::current());
+		ValidatedModel reference;
+		reference.name = "reference";
+		reference.spec = registry.Resolve(positional[2], positional[1], names, input_size, "region");
+		Load(reference, "opencv", InferenceEngine::Options());
+
+		ValidatedModel candidate;
+		candidate.name = "candidate";
+		candidate.spec = registry.Resolve(positional[4] == "-" ? "" : positional[4], positional[3], names, input_size, option("output", ""));
+		InferenceEngine::Options engine_options;
+		engine_options.backend_name = Poco::toLower(option("backend", ""));
+		engine_options.target_name = Poco::toLower(option("target", ""));
+		engine_options.threads = stoi(option("threads", "0"));
+		Load(candidate, option("engine", "opencv"), engine_options);
+
+		map<int, ClassAgreement> agreement;
+		InferenceEngine::Timings reference_warmup;
+		InferenceEngine::Timings candidate_warmup;
+		int frames = 0;
+		for (Poco::DirectoryIterator it(positional[0]), end; it != end; ++it)
+		{
+			const string extension = Poco::toLower(it.path().getExtension());
+			if (!it->isFile() || (extension != "jpg" && extension != "jpeg" && extension != "png" && extension != "bmp")) continue;
+			Mat frame = imread(it->path());
+			if (frame.empty()) continue;
+
+			//The first frame also pays for each network's lazy allocation, so it is not timed.
+			if (frames == 0)
+			{
+				Detect(reference, frame, confidence_threshold, nms_threshold);
+				Detect(candidate, frame, confidence_threshold, nms_threshold);
+				reference_warmup = reference.engine->GetTimings();
+				candidate_warmup = candidate.engine->GetTimings();
+			}
+			Compare(Detect(reference, frame, confidence_threshold, nms_threshold),
+				Detect(candidate, frame, confidence_threshold, nms_threshold), iou_threshold, agreement);
+			++frames;
+		}
+		if (frames == 0)
+		{
+			cerr << "No frames found in " << positional[0] << endl;
+			return 1;
+		}
+
+		cout << endl << frames << " frames, candidate agreement with reference at IoU " << iou_threshold << endl;
+		cout << left << setw(16) << "class" << right << setw(8) << "ref" << setw(8) << "cand" << setw(9) << "recall"
+			<< setw(10) << "precision" << setw(9) << "mean IoU" << setw(10) << "conf diff" << endl;
+		cout << fixed;
+		ClassAgreement total;
+		for (const auto& [class_id, stats] : agreement)
+		{
+			const auto& classes = reference.spec->classes;
+			PrintRow(class_id < (int)classes.size() ? classes[class_id] : to_string(class_id), stats);
+			total.reference += stats.reference;
+			total.candidate += stats.candidate;
+			total.matched += stats.matched;
+			total.iou_sum += stats.iou_sum;
+			total.confidence_delta_sum += stats.confidence_delta_sum;
+		}
+		PrintRow("all", total);
+
+		double reference_ms = (reference.engine->GetTimings().forward_us - reference_warmup.forward_us) / 1000.0 / frames;
+		double candidate_ms = (candidate.engine->GetTimings().forward_us - candidate_warmup.forward_us) / 1000.0 / frames;
+		cout << endl << setprecision(1) << "forward: reference " << reference_ms << " ms, candidate " << candidate_ms << " ms ("
+			<< setprecision(2) << reference_ms / candidate_ms << "x)" << endl;
+	}
+	catch (Poco::Exception& e)
+	{
+		cerr << e.displayText() << endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
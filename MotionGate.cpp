@@ -0,0 +1,57 @@
+#include "MotionGate.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+
+static const int thumbnail_width = 160;
+
+MotionGate::MotionGate(const Poco::Util::AbstractConfiguration& config) :
+	enabled(config.getBool("motion.enabled", false)),
+	pixel_threshold(std::min(std::max(config.getInt("motion.threshold", 25), 1), 255)),
+	sensitivity(std::max(config.getDouble("motion.sensitivity", 0.002), 0.0)),
+	learning_rate(std::min(std::max(config.getDouble("motion.learning_rate", 0.05), 0.0), 1.0)),
+	refresh_us((int64_t)(std::max(config.getDouble("motion.refresh_s", 300.0), 0.0) * 1000000.0)),
+	frames_passed(0),
+	frames_skipped(0)
+{
+}
+
+bool MotionGate::ShouldDetect(const cv::Mat& frame)
+{
+	using namespace cv;
+	if (!enabled || frame.empty()) return true;
+
+	int thumbnail_height = std::max(frame.rows * thumbnail_width / std::max(frame.cols, 1), 1);
+	resize(frame, thumbnail, Size(thumbnail_width, thumbnail_height), 0, 0, INTER_AREA);
+	if (thumbnail.channels() > 1)
+		cvtColor(thumbnail, gray, thumbnail.channels() == 4 ? COLOR_BGRA2GRAY : COLOR_BGR2GRAY);
+	else
+		thumbnail.copyTo(gray);
+	GaussianBlur(gray, gray, Size(5, 5), 0);
+
+	bool motion = false;
+	if (background.empty() || background.size() != gray.size())
+	{
+		gray.convertTo(background, CV_32F);
+		motion = true;
+	}
+	else
+	{
+		background.convertTo(background_8u, CV_8U);
+		absdiff(gray, background_8u, difference);
+		threshold(difference, difference, pixel_threshold, 255, THRESH_BINARY);
+		motion = countNonZero(difference) > sensitivity * difference.total();
+		accumulateWeighted(gray, background, learning_rate);
+	}
+
+	if (motion || (refresh_us > 0 && last_pass.isElapsed(refresh_us)))
+	{
+		last_pass.update();
+		++frames_passed;
+		return true;
+	}
+
+	++frames_skipped;
+	return false;
+}
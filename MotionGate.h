@@ -0,0 +1,43 @@
+#pragma once
+#include <cinttypes>
+
+#include <opencv2/core.hpp>
+#include <Poco/Timestamp.h>
+#include <Poco/Util/AbstractConfiguration.h>
+
+//A cheap check in front of the detector. Frames are shrunk to a thumbnail,
+//blurred and compared against a slowly adapting background. Only when enough
+//of the thumbnail has changed is the frame worth a full detection. A refresh
+//is still forced now and then so a scene that changed too slowly to register
+//is eventually detected again.
+class MotionGate
+{
+public:
+	//Reads motion.enabled, motion.threshold, motion.sensitivity, motion.learning_rate and motion.refresh_s.
+	MotionGate(const Poco::Util::AbstractConfiguration& config);
+
+	bool isEnabled() const { return enabled; }
+
+	//True when the frame should go to the detector. Always true when disabled.
+	bool ShouldDetect(const cv::Mat& frame);
+
+	uint64_t FramesPassed() const { return frames_passed; }
+	uint64_t FramesSkipped() const { return frames_skipped; }
+
+private:
+	bool enabled;
+	int pixel_threshold;
+	double sensitivity;
+	double learning_rate;
+	int64_t refresh_us;
+	Poco::Timestamp last_pass;
+
+	cv::Mat thumbnail;
+	cv::Mat gray;
+	cv::Mat background;
+	cv::Mat background_8u;
+	cv::Mat difference;
+
+	uint64_t frames_passed;
+	uint64_t frames_skipped;
+};
@@ -13,6 +13,7 @@ MqttEmitter::MqttEmitter(
     const std::string client_id,
     const int qos)
 	:
+	ThreadedDetectionProcessor("mqtt"),
 	broker_addr(broker_address),
 	user(username),
 	pass(password),
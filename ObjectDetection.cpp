@@ -24,6 +24,7 @@
 #include "URLEmitter.h"
 #include "OverWritingFrameGrabber.h"
 #include "DirectoryFrames.h"
+#include "CpuBudget.h"
 
 
 POCO_SERVER_MAIN(ObjectDetection);
@@ -58,10 +59,14 @@ int ObjectDetection::main(const std::vector<std::string>& args)
         SetupCameras();
         SetupMQTT();
         SetupURLs();
+        SetupClips();
+        SetupMetrics();
 
         StartupDetector();
         StartupMQTT();
         StartupURLs();
+        StartupClips();
+        StartupMetrics();
         StartupCameras();
 
         waitForTerminationRequest();
@@ -69,6 +74,8 @@ int ObjectDetection::main(const std::vector<std::string>& args)
         ShutdownCameras();
         ShutdownMQTT();
         ShutdownURLs();
+        ShutdownClips();
+        ShutdownMetrics();
         ShutdownDetector();
 
     }
@@ -90,7 +97,9 @@ int ObjectDetection::main(const std::vector<std::string>& args)
 
 void ObjectDetection::SetupDetector()
 {
+    CpuBudget::instance().Configure(config());
     detector = new Detector(config());
+    quality = new QualityController(config(), *detector);
 }
 
 void ObjectDetection::SetupCameras()
@@ -106,9 +115,10 @@ void ObjectDetection::SetupCameras()
 
             AutoPtr<SourceDetectionManager> manager = new SourceDetectionManager(
                                                                 camera, 
-                                                                CreateFrameSource(camera_config), 
+                                                                CreateFrameSource(camera, camera_config), 
                                                                 isInteractive(), 
                                                                 *detector,
+                                                                *quality,
                                                                 camera_config);
             managers[camera] = manager;
         }
@@ -124,16 +134,25 @@ void ObjectDetection::SetupCameras()
     }
 }
 
-Poco::AutoPtr<FrameSource> ObjectDetection::CreateFrameSource(Poco::Util::AbstractConfiguration::Ptr config)
+Poco::AutoPtr<FrameSource> ObjectDetection::CreateFrameSource(const std::string& camera, Poco::Util::AbstractConfiguration::Ptr config)
 {
+    //Tiles are cut from the full frame, which is the point of tiling.
+    int decode_scale = config->getInt("decode_scale", 1);
+    if (decode_scale > 1 && TileLayout::FromConfig(*config).IsTiled())
+    {
+        Poco::Logger::get(camera).warning("decode_scale ignored, tiled cameras need full size frames");
+        decode_scale = 1;
+    }
+
+    Poco::AutoPtr<FrameSource> source;
     if (config->has("url"))
     {   
         string url = config->getString("url");
         if (url.empty()) throw Poco::Exception("url can't be empty if property is listed");
-        return new OverWritingFrameGrabber(url);
+        source = new OverWritingFrameGrabber(camera, url, config->getBool("decode_on_demand", false), decode_scale,
+            (size_t)max(config->getInt("frame_pool", 4), 2));
     }
-
-    if (config->has("intake_directory"))
+    else if (config->has("intake_directory"))
     {
         string intake_directory = config->getString("intake_directory");
         if (intake_directory.empty()) throw Poco::Exception("intake_directory can't be empty if property is listed");
@@ -150,10 +169,21 @@ Poco::AutoPtr<FrameSource> ObjectDetection::CreateFrameSource(Poco::Util::Abstra
                 throw Poco::Exception("intake_directory must exist.");
             }
         }
-        return new DirectoryFrames(intake_directory);
+        source = new DirectoryFrames(camera, intake_directory, decode_scale);
+    }
+    else
+    {
+        source = new OverWritingFrameGrabber(camera, max(config->getInt("webcam", 0), 0), config->getBool("decode_on_demand", false), decode_scale,
+            (size_t)max(config->getInt("frame_pool", 4), 2));
     }
 
-    return new OverWritingFrameGrabber(max(config->getInt("webcam", 0), 0));
+    Poco::AutoPtr<FrameHistory> history = FrameHistory::FromConfig(camera, *config);
+    if (!history.isNull())
+    {
+        FrameHistory::Register(camera, history);
+        source->SetHistory(history);
+    }
+    return source;
 }
 
 void ObjectDetection::SetupMQTT()
@@ -194,7 +224,7 @@ void ObjectDetection::SetupMQTT()
                 }
 
 
-                mqtt_filter = new EventFilter(mqtt_class_filters, mqtt_source_filters);
+                mqtt_filter = new EventFilter("mqtt", mqtt_class_filters, mqtt_source_filters);
 
                 for (auto& [name, manager] : managers)
                 {
@@ -263,7 +293,7 @@ void ObjectDetection::SetupURLs()
                     url_source_filters.emplace_back(filter, false);
                 }
 
-                eventProcessor.url_filter = new EventFilter(url_class_filters, url_source_filters);
+                eventProcessor.url_filter = new EventFilter(url_name, url_class_filters, url_source_filters);
 
                 for (auto& [name, manager] : managers)
                 {
@@ -293,6 +323,64 @@ void ObjectDetection::SetupURLs()
     }
 }
 
+void ObjectDetection::SetupClips()
+{
+    if (!config().has("clips.directory")) return;
+
+    try
+    {
+        clips = new ClipRecorder(config());
+
+        vector<StringFilter> clip_class_filters;
+        StringTokenizer tokenizer(config().getString("clips.class_filter", "*"), ",", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+        for (auto filter : tokenizer)
+        {
+            clip_class_filters.emplace_back(filter, false);
+        }
+
+        vector<StringFilter> clip_source_filters;
+        StringTokenizer source_tokenizer(config().getString("clips.source_filter", "*"), ",", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+        for (auto filter : source_tokenizer)
+        {
+            clip_source_filters.emplace_back(filter, false);
+        }
+
+        clips_filter = new EventFilter("clips", clip_class_filters, clip_source_filters);
+        clips_filter->filteredDetectionEvent += delegate(clips.get(), &ThreadedDetectionProcessor::onDetection);
+
+        //Each clipped camera's stream is opened a second time, so only cameras the source filter lets through get one.
+        for (auto& [name, manager] : managers)
+        {
+            if (!config().has("camera." + name + ".url")) continue;
+
+            bool source_passed = false;
+            bool negated = false;
+            for (const auto& filter : clip_source_filters)
+            {
+                if (filter.isNegatation()) negated |= filter.match(name);
+                else source_passed |= filter.match(name);
+            }
+            if (!source_passed || negated) continue;
+
+            clips->AddCamera(name, config().getString("camera." + name + ".url"));
+            manager->detectionEvent += delegate(clips_filter.get(), &EventFilter::onDetectionEvent);
+        }
+    }
+    catch (Poco::Exception& e)
+    {
+        Poco::Logger::root().error("An error occurred while configuring clips -> " + e.displayText());
+    }
+    catch (std::exception& e)
+    {
+        Poco::Logger::root().error("An error occurred while configuring clips -> " + string(e.what()));
+    }
+}
+
+void ObjectDetection::SetupMetrics()
+{
+    metrics_server = new MetricsServer(config());
+}
+
 void ObjectDetection::StartupDetector()
 {
     detector->start();
@@ -300,10 +388,18 @@ void ObjectDetection::StartupDetector()
 
 void ObjectDetection::StartupCameras()
 {
+    //Frames submitted before the detector is warm would only queue behind the warm-up.
+    long ready_timeout_ms = config().getInt("detector.ready_timeout_s", 300) * 1000L;
+    if (!detector->WaitUntilReady(ready_timeout_ms))
+    {
+        Poco::Logger::root().warning("Detector still warming up, starting cameras anyway");
+    }
+
     for (auto& [name, manager] : managers)
     {
         manager->start();
     }
+    quality->start();
 }
 
 void ObjectDetection::StartupMQTT()
@@ -319,6 +415,23 @@ void ObjectDetection::StartupURLs()
     }
 }
 
+void ObjectDetection::StartupClips()
+{
+    if (!clips.isNull()) clips->start();
+}
+
+void ObjectDetection::StartupMetrics()
+{
+    try
+    {
+        metrics_server->start();
+    }
+    catch (Poco::Exception& e)
+    {
+        Poco::Logger::root().error("Could not start the metrics endpoint -> " + e.displayText());
+    }
+}
+
 void ObjectDetection::ShutdownDetector()
 {
     detector->stop();
@@ -326,6 +439,7 @@ void ObjectDetection::ShutdownDetector()
 
 void ObjectDetection::ShutdownCameras()
 {
+    quality->stop();
     for (auto& [name, manager] : managers)
     {
         manager->stop();
@@ -345,6 +459,16 @@ void ObjectDetection::ShutdownURLs()
     }
 }
 
+void ObjectDetection::ShutdownClips()
+{
+    if (!clips.isNull()) clips->stop();
+}
+
+void ObjectDetection::ShutdownMetrics()
+{
+    metrics_server->stop();
+}
+
 void ObjectDetection::ConfigureLogging()
 {
     try
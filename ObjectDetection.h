@@ -6,9 +6,12 @@
 #include <opencv2/core/utils/logger.hpp>
 
 #include "Detector.h"
+#include "QualityController.h"
 #include "SourceDetectionManager.h"
 #include "EventFilter.h"
 #include "MqttEmitter.h"
+#include "ClipRecorder.h"
+#include "MetricsServer.h"
 
 class ObjectDetection : public Poco::Util::ServerApplication
 {
@@ -23,21 +26,28 @@ protected:
 	void SetupCameras();
 	void SetupMQTT();
 	void SetupURLs();
+	void SetupClips();
+	void SetupMetrics();
 
 	void StartupDetector();
 	void StartupCameras();
 	void StartupMQTT();
 	void StartupURLs();
+	void StartupClips();
+	void StartupMetrics();
 
 	void ShutdownDetector();
 	void ShutdownCameras();
 	void ShutdownMQTT();
 	void ShutdownURLs();
+	void ShutdownClips();
+	void ShutdownMetrics();
 
 	
 
 private:
 	Poco::SharedPtr<Detector> detector;
+	Poco::SharedPtr<QualityController> quality;
 	std::map<std::string, Poco::AutoPtr<SourceDetectionManager>> managers;
 
 	Poco::SharedPtr<ThreadedDetectionProcessor> mqtt;
@@ -51,11 +61,16 @@ private:
 
 	std::unordered_map<std::string, URLEventProcessor> urls;
 
+	Poco::SharedPtr<ClipRecorder> clips;
+	Poco::SharedPtr<EventFilter> clips_filter;
+
+	Poco::SharedPtr<MetricsServer> metrics_server;
+
 	Poco::SharedPtr<Poco::LogStream> opencv_cout;
 	Poco::SharedPtr<Poco::LogStream> opencv_cerr;
 
 	cv::utils::logging::LogLevel StrToLogLevel(const std::string& log_level);
 
-	Poco::AutoPtr<FrameSource> CreateFrameSource(Poco::Util::AbstractConfiguration::Ptr config);
+	Poco::AutoPtr<FrameSource> CreateFrameSource(const std::string& camera, Poco::Util::AbstractConfiguration::Ptr config);
 };
 
@@ -0,0 +1,105 @@
+#ifdef OD_WITH_ONNXRUNTIME
+#include "OnnxRuntimeEngine.h"
+
+#include <Poco/Exception.h>
+#include <Poco/Logger.h>
+#include <Poco/Path.h>
+#include <Poco/Timestamp.h>
+#include <Poco/UnicodeConverter.h>
+
+#include <array>
+#include <cstring>
+
+
+Ort::Env& OnnxRuntimeEngine::Environment()
+{
+	static Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "ObjectDetection");
+	return env;
+}
+
+OnnxRuntimeEngine::OnnxRuntimeEngine(const ModelSpec& model, const Options& options) :
+	memory_info(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault))
+{
+	if (model.format != ModelSpec::Format::Onnx) throw Poco::InvalidArgumentException("onnxruntime only loads ONNX models", model.weights_file);
+
+	Poco::Timestamp timer;
+	Ort::SessionOptions session_options;
+	session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+	if (options.threads > 0) session_options.SetIntraOpNumThreads(options.threads);
+#ifdef _WIN32
+	std::wstring path;
+	Poco::UnicodeConverter::toUTF16(model.weights_file, path);
+	session.reset(new Ort::Session(Environment(), path.c_str(), session_options));
+#else
+	session.reset(new Ort::Session(Environment(), model.weights_file.c_str(), session_options));
+#endif
+
+	Ort::AllocatorWithDefaultOptions allocator;
+	input_name = session->GetInputNameAllocated(0, allocator).get();
+	auto input_shape = session->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+	fixed_batch = !input_shape.empty() && input_shape[0] == 1;
+	//Only [rows x cols] and [batch x rows x cols] outputs are detection rows.
+	//Others, like the raw 5-D feature maps some YOLOv5 exports also return,
+	//are left unfetched.
+	for (size_t i = 0; i < session->GetOutputCount(); ++i)
+	{
+		const std::string name = session->GetOutputNameAllocated(i, allocator).get();
+		const auto shape = session->GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+		std::string dims;
+		for (const int64_t dim : shape) dims += (dims.empty() ? "" : "x") + std::to_string(dim);
+		if (shape.size() != 2 && shape.size() != 3)
+		{
+			Poco::Logger::get("InferenceEngine").warning("Skipping output " + name + " of shape " + dims + ", detections come as [batch x rows x cols]");
+			continue;
+		}
+		//A dynamic dimension is -1 and only checked once it has a size.
+		if (shape.back() >= 0 && shape.back() <= 5)
+		{
+			throw Poco::DataFormatException("Output " + name + " of shape " + dims + " has no class scores", model.weights_file);
+		}
+		output_names.push_back(name);
+	}
+	if (output_names.empty()) throw Poco::DataFormatException("No output is shaped [batch x rows x cols]", model.weights_file);
+	for (const auto& name : output_names)
+	{
+		output_name_ptrs.push_back(name.c_str());
+	}
+
+	Poco::Logger::get("InferenceEngine").information("onnxruntime loaded " + Poco::Path(model.weights_file).getFileName() +
+		(fixed_batch ? " (batch of one)" : "") + " in " + std::to_string(timer.elapsed() / 1000) + " ms");
+}
+
+void OnnxRuntimeEngine::DoForward(const cv::Mat& blob, std::vector<cv::Mat>& outputs)
+{
+	const int batch = blob.size[0];
+	const int step = fixed_batch ? 1 : batch;
+	const size_t image_floats = (size_t)blob.size[1] * blob.size[2] * blob.size[3];
+	const char* input_names[] = { input_name.c_str() };
+
+	outputs.clear();
+	for (int first = 0; first < batch; first += step)
+	{
+		std::array<int64_t, 4> shape = { step, blob.size[1], blob.size[2], blob.size[3] };
+		float* data = const_cast<float*>(blob.ptr<float>(first));
+		Ort::Value input = Ort::Value::CreateTensor<float>(memory_info, data, image_floats * step, shape.data(), shape.size());
+		auto results = session->Run(Ort::RunOptions{ nullptr }, input_names, &input, 1, output_name_ptrs.data(), output_name_ptrs.size());
+
+		//Always handed back as [batch x rows x cols].
+		for (size_t o = 0; o < results.size(); ++o)
+		{
+			auto out_shape = results[o].GetTensorTypeAndShapeInfo().GetShape();
+			//Anything else would be copied in part and decoded as rows.
+			CV_Assert(out_shape.size() == 3 ? out_shape[0] == step : out_shape.size() == 2 && step == 1);
+			const int cols = (int)out_shape.back();
+			const int rows = (int)out_shape[out_shape.size() - 2];
+			CV_Assert(cols > 5);
+			if (first == 0)
+			{
+				int sizes[] = { batch, rows, cols };
+				outputs.push_back(cv::Mat(3, sizes, CV_32F));
+			}
+			std::memcpy(outputs[o].ptr<float>(first), results[o].GetTensorData<float>(), (size_t)step * rows * cols * sizeof(float));
+		}
+	}
+}
+#endif
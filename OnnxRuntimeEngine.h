@@ -0,0 +1,35 @@
+#pragma once
+#ifdef OD_WITH_ONNXRUNTIME
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <onnxruntime_cxx_api.h>
+
+#include "InferenceEngine.h"
+
+//Microsoft's ONNX Runtime on its CPU execution provider. Loads ONNX models
+//only. A model exported with a fixed batch of one is run an image at a time
+//and its outputs stacked, so to the detector it still looks batched. Only
+//outputs shaped [rows x cols] or [batch x rows x cols] are fetched.
+class OnnxRuntimeEngine : public InferenceEngine
+{
+public:
+	OnnxRuntimeEngine(const ModelSpec& model, const Options& options);
+
+	std::string Name() const { return "onnxruntime"; }
+
+protected:
+	void DoForward(const cv::Mat& blob, std::vector<cv::Mat>& outputs);
+
+private:
+	static Ort::Env& Environment();
+
+	std::unique_ptr<Ort::Session> session;
+	Ort::MemoryInfo memory_info;
+	std::string input_name;
+	std::vector<std::string> output_names;
+	std::vector<const char*> output_name_ptrs;
+	bool fixed_batch;
+};
+#endif
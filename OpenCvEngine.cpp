@@ -0,0 +1,40 @@
+#include "OpenCvEngine.h"
+#include "DnnNames.h"
+
+#include <Poco/Logger.h>
+#include <Poco/Path.h>
+#include <Poco/Timestamp.h>
+
+#include <sstream>
+
+
+OpenCvEngine::OpenCvEngine(const ModelSpec& model, const Options& options)
+{
+	//Reading covers parsing the network. Fusing its layers waits for the first forward.
+	Poco::Timestamp read_timer;
+	if (model.format == ModelSpec::Format::Darknet)
+	{
+		net = cv::dnn::readNetFromDarknet(model.config_file, model.weights_file);
+	}
+	else
+	{
+		net = cv::dnn::readNet(model.weights_file, model.config_file);
+	}
+	const Poco::Timestamp::TimeDiff read_us = read_timer.elapsed();
+
+	Poco::Timestamp setup_timer;
+	if (!options.backend_name.empty()) net.setPreferableBackend(StrToBackend(options.backend_name));
+	if (!options.target_name.empty()) net.setPreferableTarget(StrToTarget(options.target_name));
+	output_layers = net.getUnconnectedOutLayersNames();
+
+	std::stringstream msg;
+	msg << "opencv loaded " << Poco::Path(model.weights_file).getFileName()
+		<< ": read " << read_us / 1000 << " ms, setup " << setup_timer.elapsed() / 1000 << " ms";
+	Poco::Logger::get("InferenceEngine").information(msg.str());
+}
+
+void OpenCvEngine::DoForward(const cv::Mat& blob, std::vector<cv::Mat>& outputs)
+{
+	net.setInput(blob);
+	net.forward(outputs, output_layers);
+}
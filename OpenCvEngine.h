@@ -0,0 +1,21 @@
+#pragma once
+#include <opencv2/dnn.hpp>
+
+#include "InferenceEngine.h"
+
+//OpenCV's dnn module. Loads every model format and runs on whichever backend
+//and target detector.backend and detector.target name.
+class OpenCvEngine : public InferenceEngine
+{
+public:
+	OpenCvEngine(const ModelSpec& model, const Options& options);
+
+	std::string Name() const { return "opencv"; }
+
+protected:
+	void DoForward(const cv::Mat& blob, std::vector<cv::Mat>& outputs);
+
+private:
+	cv::dnn::Net net;
+	std::vector<cv::String> output_layers;
+};
@@ -1,7 +1,40 @@
 #include "OverWritingFrameGrabber.h"
+#include "CpuBudget.h"
+#include <Poco/Environment.h>
+#include <Poco/Exception.h>
 #include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
 
-OverWritingFrameGrabber::OverWritingFrameGrabber(const std::string& camera_init_str):
+//OpenCV's FFMPEG backend only reads its capture options from the environment,
+//when a stream is opened.
+static const std::string capture_options_variable = "OPENCV_FFMPEG_CAPTURE_OPTIONS";
+static Poco::FastMutex mu_capture_options;
+
+//The FFMPEG backend reports either the stream's codec tag (MJPG) or the
+//codec's name (mjpeg).
+static bool IsMotionJpeg(const int fourcc)
+{
+	std::string tag;
+	for (int shift = 0; shift < 32; shift += 8) tag += (char)std::tolower((fourcc >> shift) & 0xff);
+	return tag == "mjpg" || tag == "mjpe";
+}
+
+OverWritingFrameGrabber::OverWritingFrameGrabber(const std::string& source_name, const std::string& camera_init_str, const bool decode_on_demand, const int decode_scale, const size_t frame_pool):
+	log(Poco::Logger::get(source_name)),
+	pool(frame_pool),
+	grab_histogram(Metrics::instance().Histogram("od_grab_seconds", "Time spent reading and decoding a frame from the camera", "camera", source_name)),
+	on_demand(decode_on_demand),
+	frame_wanted(false),
+	on_demand_wait_ms(0),
+	frames_retrieved(0),
+	frames_discarded(0),
+	frames_skipped(0),
+	decode_scale(decode_scale),
+	scaled_by_capture(decode_scale == 1),
+	capture_scale_checked(decode_scale == 1),
 	want_to_stop(false)
 {
 	if (camera_init_str.empty())
@@ -10,16 +43,99 @@ OverWritingFrameGrabber::OverWritingFrameGrabber(const std::string& camera_init_
 	}
 	else
 	{
-		cam = new cv::VideoCapture(camera_init_str);
+		OpenScaled(camera_init_str);
 	}
 }
 
-OverWritingFrameGrabber::OverWritingFrameGrabber(const int camera_init_int) :
+OverWritingFrameGrabber::OverWritingFrameGrabber(const std::string& source_name, const int camera_init_int, const bool decode_on_demand, const int decode_scale, const size_t frame_pool) :
+	log(Poco::Logger::get(source_name)),
+	pool(frame_pool),
+	grab_histogram(Metrics::instance().Histogram("od_grab_seconds", "Time spent reading and decoding a frame from the camera", "camera", source_name)),
+	on_demand(decode_on_demand),
+	frame_wanted(false),
+	on_demand_wait_ms(0),
+	frames_retrieved(0),
+	frames_discarded(0),
+	frames_skipped(0),
+	decode_scale(decode_scale),
+	scaled_by_capture(decode_scale == 1),
+	capture_scale_checked(decode_scale == 1),
 	want_to_stop(false)
 {
-	cam = new cv::VideoCapture(camera_init_int);
+	OpenScaled(camera_init_int);
+}
+
+void OverWritingFrameGrabber::OpenScaled(const std::string& location)
+{
+	if (decode_scale == 1)
+	{
+		cam = new cv::VideoCapture(location);
+		return;
+	}
+	if (decode_scale != 2 && decode_scale != 4 && decode_scale != 8) throw Poco::InvalidArgumentException("decode_scale must be 1, 2, 4 or 8");
+
+	//Opened plainly first for the stream's own size and codec. Only Motion JPEG
+	//is worth opening again with lowres.
+	cam = new cv::VideoCapture(location);
+	if (!cam->isOpened()) return;
+	native_size = cv::Size((int)cam->get(cv::CAP_PROP_FRAME_WIDTH), (int)cam->get(cv::CAP_PROP_FRAME_HEIGHT));
+	if (cam->getBackendName() != "FFMPEG" || !IsMotionJpeg((int)cam->get(cv::CAP_PROP_FOURCC)))
+	{
+		log.information("Stream cannot be decoded at a reduced size, frames will be shrunk to 1/" + std::to_string(decode_scale) + " after decoding");
+		return;
+	}
+	cam->release();
+
+	//lowres is log2 of the scale. Whether the decoder is ever given it depends
+	//on the OpenCV build, so the first frame is checked.
+	const int lowres = decode_scale == 2 ? 1 : decode_scale == 4 ? 2 : 3;
+	{
+		Poco::FastMutex::ScopedLock locker(mu_capture_options);
+		const std::string previous = Poco::Environment::get(capture_options_variable, "");
+		Poco::Environment::set(capture_options_variable, (previous.empty() ? "" : previous + "|") + "lowres;" + std::to_string(lowres));
+		cam = new cv::VideoCapture(location);
+		Poco::Environment::set(capture_options_variable, previous);
+	}
+	scaled_by_capture = true;
+	log.information("Asking the Motion JPEG decoder for frames at 1/" + std::to_string(decode_scale) + " size");
+}
+
+void OverWritingFrameGrabber::OpenScaled(const int index)
+{
+	cam = new cv::VideoCapture(index);
+	if (decode_scale == 1) return;
+	if (decode_scale != 2 && decode_scale != 4 && decode_scale != 8) throw Poco::InvalidArgumentException("decode_scale must be 1, 2, 4 or 8");
+	if (!cam->isOpened()) return;
+
+	//Drivers pick the nearest mode they have, which may be no smaller at all.
+	const double width = cam->get(cv::CAP_PROP_FRAME_WIDTH);
+	const double height = cam->get(cv::CAP_PROP_FRAME_HEIGHT);
+	if (width <= 0.0 || height <= 0.0) return;
+	native_size = cv::Size((int)width, (int)height);
+	cam->set(cv::CAP_PROP_FRAME_WIDTH, width / decode_scale);
+	cam->set(cv::CAP_PROP_FRAME_HEIGHT, height / decode_scale);
+	scaled_by_capture = cam->get(cv::CAP_PROP_FRAME_WIDTH) <= width / decode_scale;
+	log.information(scaled_by_capture ? "Capturing at " + std::to_string((int)cam->get(cv::CAP_PROP_FRAME_WIDTH)) + "x" + std::to_string((int)cam->get(cv::CAP_PROP_FRAME_HEIGHT)) :
+		"Camera has no smaller mode, frames will be shrunk to 1/" + std::to_string(decode_scale) + " after capture");
 }
 
+bool OverWritingFrameGrabber::CheckCaptureScale(const cv::Mat& frame)
+{
+	capture_scale_checked = true;
+	if (native_size.empty()) return true;
+
+	//lowres rounds up, so a frame within one pixel of the asked size is scaled.
+	const bool scaled = frame.cols * decode_scale < native_size.width + decode_scale && frame.rows * decode_scale < native_size.height + decode_scale;
+	if (scaled)
+	{
+		log.information("Decoding at " + std::to_string(frame.cols) + "x" + std::to_string(frame.rows) + ", 1/" + std::to_string(decode_scale) + " size");
+		return true;
+	}
+	scaled_by_capture = false;
+	log.warning("Capture ignored the smaller size asked for and decodes at " + std::to_string(frame.cols) + "x" + std::to_string(frame.rows) +
+		", frames will be shrunk to 1/" + std::to_string(decode_scale) + " after decoding");
+	return false;
+}
 
 OverWritingFrameGrabber::~OverWritingFrameGrabber()
 {
@@ -28,21 +144,40 @@ OverWritingFrameGrabber::~OverWritingFrameGrabber()
 
 void OverWritingFrameGrabber::start()
 {
+	const double fps = cam->get(cv::CAP_PROP_FPS);
+	if (fps > 0.0) on_demand_wait_ms = (int)std::ceil(1500.0 / fps);
 	frame_thread.start(*this);
 }
 
 void OverWritingFrameGrabber::stop()
 {
 	want_to_stop = true;
-	if (frame_thread.isRunning()) frame_thread.join();
+	if (!frame_thread.isRunning()) return;
+	frame_thread.join();
+	if (on_demand)
+	{
+		log.information("Retrieved " + std::to_string(frames_retrieved) + " frames and discarded " + std::to_string(frames_discarded) + " undecoded");
+	}
+	if (frames_skipped > 0)
+	{
+		log.information("Skipped " + std::to_string(frames_skipped) + " frames while all " + std::to_string(pool.Size()) + " frame buffers were held");
+	}
 }
 
-cv::Mat OverWritingFrameGrabber::GetNextFrame(const int wait_ms)
+cv::Mat OverWritingFrameGrabber::GetNextFrame(Poco::Timestamp& captured, const int wait_ms)
 {
-	if (frame_available.tryWait(wait_ms))
+	//Ask for the next grabbed frame to be retrieved. A request outlives a call
+	//that gives up waiting, and the frame retrieved for it goes to the next call.
+	int wait = wait_ms;
+	if (on_demand)
 	{
-		Poco::ScopedLock<Poco::Mutex> locker(mu_frame);
-		return frame;
+		if (frame_available.tryWait(0)) return pool.Latest(captured);
+		frame_wanted = true;
+		wait = std::max(wait_ms, on_demand_wait_ms);
+	}
+	if (frame_available.tryWait(wait))
+	{
+		return pool.Latest(captured);
 	}
 		
 	return cv::Mat();
@@ -50,18 +185,58 @@ cv::Mat OverWritingFrameGrabber::GetNextFrame(const int wait_ms)
 
 void OverWritingFrameGrabber::run()
 {	
-	cv::Mat local_frame;
+	CpuBudget::instance().PinDecoder();
 	Poco::Thread::sleep(1000);
 	while (!want_to_stop)
 	{
-		*cam >> local_frame;
+		Poco::Timestamp grab_timer;
+		if (!cam->grab()) break;
+		const Poco::Timestamp captured;
+		//A frame due for the history is decoded even if nobody else wants it.
+		const bool history_due = !history.isNull() && history->Due();
+		const bool wanted = !on_demand || frame_wanted.exchange(false);
+		if (!wanted && !history_due)
+		{
+			++frames_discarded;
+			continue;
+		}
+
+		cv::Mat* buffer = pool.Acquire();
+		if (buffer == nullptr)
+		{
+			//Still wanted, by the next frame once a buffer is let go.
+			if (on_demand && wanted) frame_wanted = true;
+			if (frames_skipped++ == 0) log.warning("All " + std::to_string(pool.Size()) + " frame buffers are held downstream, skipping frames");
+			continue;
+		}
+
+		//Both write into the buffer in place once it has the frame's size.
+		bool decoded;
+		if (scaled_by_capture)
+		{
+			decoded = cam->retrieve(*buffer) && !buffer->empty();
+			//Came out whole after all, so it is shrunk like the ones after it.
+			if (decoded && !capture_scale_checked && !CheckCaptureScale(*buffer)) cv::swap(*buffer, decode_buffer);
+		}
+		else
+		{
+			decoded = cam->retrieve(decode_buffer) && !decode_buffer.empty();
+		}
+		if (!decoded) break;
+		if (!scaled_by_capture)
+		{
+			cv::resize(decode_buffer, *buffer, cv::Size(decode_buffer.cols / decode_scale, decode_buffer.rows / decode_scale), 0, 0, cv::INTER_AREA);
+		}
+		grab_histogram.Observe(grab_timer.elapsed());
 
-		if (local_frame.empty()) break;
+		if (buffer->empty()) break;
 		else
 		{
-			Poco::ScopedLock<Poco::Mutex> locker(mu_frame);
-			frame = local_frame;
-			frame_available.set();
+			++frames_retrieved;
+			pool.Publish(captured);
+			if (wanted) frame_available.set();
+			//Published frames are never written again, so it can be encoded after handing it out.
+			if (history_due) history->Add(*buffer, captured);
 		}
 	}
 }
@@ -2,32 +2,85 @@
 #include <Poco/Runnable.h>
 #include <Poco/Timestamp.h>
 #include <Poco/Event.h>
+#include <Poco/Logger.h>
 #include <Poco/Mutex.h>
 #include <Poco/SharedPtr.h>
 #include <Poco/Thread.h>
 #include <queue>
+#include <atomic>
 #include <opencv2/videoio.hpp>
 #include "FrameSource.h"
+#include "FramePool.h"
+#include "Metrics.h"
 
+//Reads a camera on its own thread so the stream never backs up, keeping only
+//the newest frame. With decode_on_demand the thread only grab()s, which keeps
+//the stream drained, and a frame is retrieve()d, converted to BGR and copied
+//out only when GetNextFrame asks for one. The capture is still only ever
+//touched from the grabbing thread.
+//
+//With a decode_scale of 2, 4 or 8 frames come out that many times smaller.
+//Motion JPEG streams are asked to decode straight to the smaller size through
+//FFmpeg's lowres option and webcams are asked for a smaller mode. Neither is
+//taken on trust: the first frame is checked against the source's own size.
+//Anything that still arrives whole is shrunk before it is handed out, so only
+//the one full size frame the decoder writes into is ever held.
+//
+//Frames are decoded into a FramePool of frame_pool buffers and handed out
+//shared, not copied. A frame handed out is never written to again, so
+//callers must clone it before drawing on it. When every buffer is still held
+//downstream the newest frames are skipped until one is let go.
 class OverWritingFrameGrabber : public FrameSource, Poco::Runnable
 {
 public:
-	OverWritingFrameGrabber(const int camera_init_int);
-	OverWritingFrameGrabber(const std::string& camera_init_str);
+	OverWritingFrameGrabber(const std::string& source_name, const int camera_init_int, const bool decode_on_demand = false, const int decode_scale = 1,
+		const size_t frame_pool = 4);
+	OverWritingFrameGrabber(const std::string& source_name, const std::string& camera_init_str, const bool decode_on_demand = false, const int decode_scale = 1,
+		const size_t frame_pool = 4);
 	~OverWritingFrameGrabber();
 
-	virtual cv::Mat GetNextFrame(const int wait_ms = 100) override;
+	virtual cv::Mat GetNextFrame(Poco::Timestamp& captured, const int wait_ms = 100) override;
 
 	void start() override;
 	void run() override;
 	void stop() override;
+	bool DecodesOnDemand() const override { return on_demand; }
+	int DecodeScale() const override { return decode_scale; }
+
+	uint64_t FramesRetrieved() const { return frames_retrieved; }
+	uint64_t FramesDiscarded() const { return frames_discarded; }
+	uint64_t FramesSkipped() const { return frames_skipped; }
+
 private:
+	Poco::Logger& log;
 	Poco::SharedPtr<cv::VideoCapture> cam;
 	Poco::Event frame_available;
-	Poco::Mutex mu_frame;
-	cv::Mat frame;
+	FramePool pool;
+	//Full size frames waiting to be shrunk, when the capture can't decode smaller itself.
+	cv::Mat decode_buffer;
+	LatencyHistogram& grab_histogram;
+
+	bool on_demand;
+	std::atomic<bool> frame_wanted;
+	//On demand a call waits at least this long, a frame and a half, for the next grab to be retrieved.
+	int on_demand_wait_ms;
+	std::atomic<uint64_t> frames_retrieved;
+	std::atomic<uint64_t> frames_discarded;
+	//Grabbed while every pool buffer was still held.
+	std::atomic<uint64_t> frames_skipped;
+
+	int decode_scale;
+	//False when frames arrive at full size and have to be shrunk here.
+	bool scaled_by_capture;
+	//The source's size before any scaling was asked for. Empty when unknown.
+	cv::Size native_size;
+	bool capture_scale_checked;
+	void OpenScaled(const std::string& location);
+	void OpenScaled(const int index);
+	//Grabbing thread, first frame only. False, and scaled_by_capture cleared, when
+	//the capture handed out a frame no smaller than the source.
+	bool CheckCaptureScale(const cv::Mat& frame);
 
 	Poco::Thread frame_thread;
 	volatile bool want_to_stop;
 };
-
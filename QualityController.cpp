@@ -0,0 +1,199 @@
+#include "QualityController.h"
+
+#include <Poco/Exception.h>
+#include <Poco/NumberParser.h>
+#include <Poco/StringTokenizer.h>
+#include <Poco/Timestamp.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+
+QualityController::QualityController(const Poco::Util::AbstractConfiguration& config, Detector& detector) :
+	want_to_stop(false),
+	log(Poco::Logger::get("QualityController")),
+	detector(detector),
+	last_sample(),
+	overloaded_samples(0),
+	underloaded_samples(0)
+{
+	enabled = config.getBool("quality.enabled", false);
+	default_ladder = config.getString("quality.ladder", "");
+	interval_ms = std::max(config.getInt("quality.interval_ms", 2000), 100);
+	high_utilization = config.getDouble("quality.high_utilization", 0.9);
+	low_utilization = std::min(config.getDouble("quality.low_utilization", 0.6), high_utilization);
+	high_wait_us = (int64_t)std::max(config.getInt("quality.high_wait_ms", 1000), 0) * 1000;
+	low_wait_us = std::min((int64_t)std::max(config.getInt("quality.low_wait_ms", 200), 0) * 1000, high_wait_us);
+	down_samples = std::max(config.getInt("quality.down_samples", 2), 1);
+	up_samples = std::max(config.getInt("quality.up_samples", 5), 1);
+	thread.setName("QualityController");
+}
+
+QualityController::~QualityController()
+{
+	stop();
+}
+
+std::vector<QualityController::Rung> QualityController::ParseLadder(const std::string& ladder)
+{
+	std::vector<Rung> rungs;
+	Poco::StringTokenizer tokenizer(ladder, ",", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+	for (const auto& token : tokenizer)
+	{
+		size_t at = token.find('@');
+		Rung rung = { Poco::NumberParser::parse(token.substr(0, at)), 1.0 };
+		if (at != std::string::npos) rung.fps_scale = Poco::NumberParser::parseFloat(token.substr(at + 1));
+		if (rung.analysis_size <= 0 || rung.fps_scale <= 0.0 || rung.fps_scale > 1.0) throw Poco::SyntaxException("Bad quality rung", token);
+		rungs.push_back(rung);
+	}
+	return rungs;
+}
+
+std::string QualityController::Describe(const Rung& rung)
+{
+	std::stringstream description;
+	description << rung.analysis_size;
+	if (rung.fps_scale < 1.0) description << " at " << std::setprecision(3) << rung.fps_scale << " fps";
+	return description.str();
+}
+
+std::vector<QualityController::Rung> QualityController::Register(const std::string& src_name, const Poco::Util::AbstractConfiguration& camera_config)
+{
+	if (!enabled) return std::vector<Rung>();
+	std::vector<Rung> ladder = ParseLadder(camera_config.getString("quality.ladder", default_ladder));
+	if (ladder.size() < 2) return std::vector<Rung>();
+
+	Camera camera = {};
+	camera.priority = camera_config.getInt("priority", 0);
+	camera.ladder = ladder;
+	camera.floor = (size_t)std::min(std::max(camera_config.getInt("quality.floor", (int)ladder.size() - 1), 0), (int)ladder.size() - 1);
+	camera.rung_gauge = &Metrics::instance().Gauge("od_quality_rung", "Quality ladder rung a camera runs at, 0 being the best", "camera", src_name);
+	camera.rung_gauge->Set(0);
+	Poco::ScopedLock<Poco::Mutex> locker(mu_cameras);
+	cameras[src_name] = camera;
+	return ladder;
+}
+
+size_t QualityController::CurrentRung(const std::string& src_name)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_cameras);
+	auto it = cameras.find(src_name);
+	return it == cameras.end() ? 0 : it->second.rung;
+}
+
+std::map<std::string, size_t> QualityController::Rungs()
+{
+	std::map<std::string, size_t> rungs;
+	Poco::ScopedLock<Poco::Mutex> locker(mu_cameras);
+	for (const auto& [src_name, camera] : cameras) rungs[src_name] = camera.rung;
+	return rungs;
+}
+
+void QualityController::start()
+{
+	if (!enabled) return;
+	{
+		Poco::ScopedLock<Poco::Mutex> locker(mu_cameras);
+		if (cameras.empty()) return;
+	}
+	want_to_stop = false;
+	ev_stop.reset();
+	thread.start(*this);
+}
+
+void QualityController::stop()
+{
+	want_to_stop = true;
+	ev_stop.set();
+	if (!thread.isRunning()) return;
+	thread.join();
+
+	Poco::ScopedLock<Poco::Mutex> locker(mu_cameras);
+	for (const auto& [src_name, camera] : cameras)
+	{
+		log.information(src_name + " finished on rung " + std::to_string(camera.rung) + " (" + Describe(camera.ladder[camera.rung]) + ") after " +
+			std::to_string(camera.steps_down) + " steps down and " + std::to_string(camera.steps_up) + " up");
+	}
+}
+
+void QualityController::run()
+{
+	last_sample = detector.GetLoadStats();
+	Poco::Timestamp interval_timer;
+	while (!want_to_stop)
+	{
+		if (ev_stop.tryWait(interval_ms)) break;
+		Sample(interval_timer.elapsed());
+		interval_timer.update();
+	}
+}
+
+void QualityController::Sample(const int64_t elapsed_us)
+{
+	Detector::LoadStats sample = detector.GetLoadStats();
+	const double utilization = elapsed_us > 0 ?
+		(double)(sample.busy_us - last_sample.busy_us) / ((double)elapsed_us * (double)std::max(sample.workers, (size_t)1)) : 0.0;
+	const uint64_t jobs = sample.jobs_run - last_sample.jobs_run;
+	int64_t wait_us = jobs ? (sample.total_wait_us - last_sample.total_wait_us) / (int64_t)jobs : 0;
+	//Nothing taken from a non-empty queue all interval is as backed up as it gets.
+	if (jobs == 0 && sample.queued > 0) wait_us = elapsed_us;
+	last_sample = sample;
+
+	const bool overloaded = utilization >= high_utilization || wait_us >= high_wait_us;
+	const bool underloaded = utilization <= low_utilization && wait_us <= low_wait_us;
+	overloaded_samples = overloaded ? overloaded_samples + 1 : 0;
+	underloaded_samples = underloaded ? underloaded_samples + 1 : 0;
+
+	std::stringstream reason;
+	reason << "utilization " << (int)(utilization * 100.0) << "%, queue wait " << wait_us / 1000 << " ms";
+	log.debug(reason.str());
+	//Whether or not a camera could move, the next decision waits for fresh samples.
+	if (overloaded_samples >= down_samples)
+	{
+		Step(true, reason.str());
+		overloaded_samples = 0;
+	}
+	else if (underloaded_samples >= up_samples)
+	{
+		Step(false, reason.str());
+		underloaded_samples = 0;
+	}
+}
+
+bool QualityController::Step(const bool down, const std::string& reason)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_cameras);
+	Camera* chosen = nullptr;
+	std::string chosen_name;
+	for (auto& [src_name, camera] : cameras)
+	{
+		if (down ? camera.rung >= camera.floor : camera.rung == 0) continue;
+		bool better = chosen == nullptr;
+		if (!better && down) better = camera.priority < chosen->priority || (camera.priority == chosen->priority && camera.rung < chosen->rung);
+		if (!better && !down) better = camera.priority > chosen->priority || (camera.priority == chosen->priority && camera.rung > chosen->rung);
+		if (better)
+		{
+			chosen = &camera;
+			chosen_name = src_name;
+		}
+	}
+	if (chosen == nullptr) return false;
+
+	if (down)
+	{
+		chosen->rung++;
+		chosen->steps_down++;
+	}
+	else
+	{
+		chosen->rung--;
+		chosen->steps_up++;
+	}
+	chosen->rung_gauge->Set((int64_t)chosen->rung);
+	const std::string message = chosen_name + (down ? " down" : " up") + " to rung " + std::to_string(chosen->rung) +
+		" (" + Describe(chosen->ladder[chosen->rung]) + "), " + reason;
+	if (down) log.warning(message);
+	else log.information(message);
+	return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <cinttypes>
+
+#include <Poco/Logger.h>
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
+#include <Poco/Mutex.h>
+#include <Poco/Event.h>
+#include <Poco/Util/AbstractConfiguration.h>
+
+#include "Detector.h"
+#include "Metrics.h"
+
+//Trades camera quality for latency when the detector falls behind. Every
+//quality.interval_ms it samples how busy the detector workers were and how
+//long jobs waited in the queue. After quality.down_samples overloaded samples
+//in a row one camera is stepped one rung down its ladder, the lowest priority
+//camera first and among those the least degraded. After quality.up_samples
+//samples with headroom one camera is stepped back up, highest priority first.
+//The gap between the high and low thresholds and the longer wait before
+//stepping up keep cameras from flapping between rungs.
+//
+//A ladder lists rungs from best to worst, each an analysis size optionally
+//followed by @ and the fraction of the camera's fps to run at (Ex. 608,416,320,320@0.5).
+//Cameras only ever move between adjacent rungs and never below their floor.
+class QualityController : public Poco::Runnable
+{
+public:
+	QualityController(const Poco::Util::AbstractConfiguration& config, Detector& detector);
+	virtual ~QualityController();
+
+	void start();
+	void run();
+	void stop();
+
+	bool isEnabled() const { return enabled; }
+
+	struct Rung
+	{
+		int analysis_size;
+		double fps_scale;
+	};
+
+	//Reads the camera's quality.ladder, falling back to quality.ladder, and
+	//quality.floor. Returns the camera's ladder, empty when it has none and
+	//keeps its configured settings.
+	std::vector<Rung> Register(const std::string& src_name, const Poco::Util::AbstractConfiguration& camera_config);
+
+	//Index into the camera's ladder it should be running at now.
+	size_t CurrentRung(const std::string& src_name);
+	std::map<std::string, size_t> Rungs();
+
+	static std::vector<Rung> ParseLadder(const std::string& ladder);
+	static std::string Describe(const Rung& rung);
+
+private:
+	volatile bool want_to_stop;
+	Poco::Logger& log;
+	Detector& detector;
+
+	bool enabled;
+	std::string default_ladder;
+	long interval_ms;
+	double high_utilization;
+	double low_utilization;
+	int64_t high_wait_us;
+	int64_t low_wait_us;
+	int down_samples;
+	int up_samples;
+
+	struct Camera
+	{
+		int priority;
+		std::vector<Rung> ladder;
+		size_t floor;
+		size_t rung;
+		uint64_t steps_down;
+		uint64_t steps_up;
+		MetricGauge* rung_gauge;
+	};
+	Poco::Mutex mu_cameras;
+	std::map<std::string, Camera> cameras;
+
+	Detector::LoadStats last_sample;
+	int overloaded_samples;
+	int underloaded_samples;
+	void Sample(const int64_t elapsed_us);
+	bool Step(const bool down, const std::string& reason);
+
+	Poco::Event ev_stop;
+	Poco::Thread thread;
+};
@@ -1,6 +1,9 @@
 #include "SourceDetectionManager.h"
+#include "CpuBudget.h"
 
 #include <Poco/Path.h>
+#include <Poco/File.h>
+#include <Poco/Util/Application.h>
 #include <Poco/Exception.h>
 #include <Poco/String.h>
 #include <Poco/Debugger.h>
@@ -10,6 +13,7 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <future>
@@ -22,14 +26,20 @@ SourceDetectionManager::SourceDetectionManager(
 	Poco::AutoPtr<FrameSource> frameSource,
 	const bool showWindows,
 	Detector& objectDetector,
+	QualityController& qualityController,
 	Poco::AutoPtr<Poco::Util::AbstractConfiguration> config):
 	src_name(name),
 	log(Poco::Logger::get(name)),
 	isInteractive(showWindows),
 	frame_source(frameSource),
 	detector(objectDetector),
-	confidence_threshold((float)config->getDouble("confidence_threshold", 0.35)),
-	nms_threshold((float)config->getDouble("nms_threshold", 0.48)),
+	motion_gate(*config),
+	dispatch_histogram(Metrics::instance().Histogram("od_dispatch_seconds", "Time spent handing a camera's detections to the emitters", "camera", name)),
+	decode_scale(frameSource->DecodeScale()),
+	quality(qualityController),
+	quality_rung(0),
+	confidence_threshold((float)config->getDouble("yolo.confidence_threshold", config->getDouble("confidence_threshold", 0.35))),
+	nms_threshold((float)config->getDouble("yolo.nms_threshold", config->getDouble("nms_threshold", 0.48))),
 	want_to_stop(false)
 	
 {
@@ -38,7 +48,48 @@ SourceDetectionManager::SourceDetectionManager(
 		cam_detect_period_us = (int64_t)((1.0 / cam_fps) * 1000000.0);
 	else
 		cam_detect_period_us = 0;
-	
+	base_detect_period_us = cam_detect_period_us;
+
+	profile.tiling = TileLayout::FromConfig(*config);
+	if (config->has("mask"))
+	{
+		Poco::Path mask_path(config->getString("mask"));
+		if (!Poco::File(mask_path).exists())
+		{
+			mask_path = Poco::Path(Poco::Util::Application::instance().config().getString("application.dir"));
+			mask_path.append(config->getString("mask"));
+		}
+		profile.mask = new DetectionMask(mask_path.toString(), (float)config->getDouble("mask.min_overlap", 0.5));
+		log.information("Using detection mask " + mask_path.toString());
+	}
+	profile.model = detector.ResolveModel(*config);
+	profile.priority = config->getInt("priority", 0);
+	profile.weight = config->getDouble("weight", 1.0);
+	profile.deadline_us = cam_detect_period_us;
+
+	//Every rung's model is resolved now so the detector warms them all up front.
+	quality_ladder = quality.Register(src_name, *config);
+	for (const auto& rung : quality_ladder)
+	{
+		ladder_models.push_back(detector.ResolveModel(*config, rung.analysis_size));
+	}
+	if (!ladder_models.empty())
+	{
+		profile.model = ladder_models.front();
+		profile.alternate_models.assign(ladder_models.begin() + 1, ladder_models.end());
+	}
+	detector.ConfigureSource(src_name, profile);
+}
+
+void SourceDetectionManager::ApplyQualityRung(const size_t rung)
+{
+	const QualityController::Rung& settings = quality_ladder[rung];
+	cam_detect_period_us = (int64_t)((double)base_detect_period_us / settings.fps_scale);
+	profile.model = ladder_models[rung];
+	profile.deadline_us = cam_detect_period_us;
+	detector.ConfigureSource(src_name, profile);
+	quality_rung = rung;
+	log.information("Running at quality rung " + std::to_string(rung) + ": " + QualityController::Describe(settings));
 }
 
 SourceDetectionManager::~SourceDetectionManager()
@@ -65,6 +116,11 @@ void SourceDetectionManager::stop()
 
 	frame_source->stop();
 	if (managementThread.isRunning()) managementThread.join();
+	if (should_log && motion_gate.isEnabled())
+	{
+		log.information("Motion gate passed " + std::to_string(motion_gate.FramesPassed()) +
+			" frames and skipped " + std::to_string(motion_gate.FramesSkipped()));
+	}
 	if (should_log) log.information("Stopped");
 }
 
@@ -89,6 +145,35 @@ void SourceDetectionManager::drawPred(std::string class_name, float conf, int le
 	putText(frame, label, Point(left, top), FONT_HERSHEY_SIMPLEX, 0.5, Scalar());
 }
 
+void SourceDetectionManager::onDetectionComplete(const uint64_t job_id, Detector::DetectionResult& result)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_completed_detection);
+	completed_detections[job_id] = std::move(result);
+	ev_detection_complete.set();
+}
+
+bool SourceDetectionManager::TakeCompletedDetection(const uint64_t job_id, Detector::DetectionResult& result, const long wait_ms)
+{
+	//A late result for an abandoned job may have used up the event after this job's
+	//result was stored, so look before waiting as well as after.
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		{
+			Poco::ScopedLock<Poco::Mutex> locker(mu_completed_detection);
+			auto it = completed_detections.find(job_id);
+			if (it != completed_detections.end())
+			{
+				result = std::move(it->second);
+				//Job ids only grow, so every result up to this one belongs to an abandoned job.
+				completed_detections.erase(completed_detections.begin(), std::next(it));
+				return true;
+			}
+		}
+		if (attempt == 0 && !ev_detection_complete.tryWait(wait_ms)) return false;
+	}
+	return false;
+}
+
 void SourceDetectionManager::run()
 {
 	if (Poco::Thread::current() == &managementThread) management();
@@ -104,6 +189,9 @@ void SourceDetectionManager::management()
 	using namespace std;
 	using namespace cv;
 	
+	//Directory sources decode their frames on this thread. Camera grabbers decode
+	//on their own, so pinning this mostly idle thread would only crowd them.
+	if (frame_source->DecodesOnCallingThread()) CpuBudget::instance().PinDecoder();
 	while (!want_to_stop)
 	{
 		try
@@ -120,44 +208,94 @@ void SourceDetectionManager::management()
 			bool is_new_detection = false;
 			bool detection_in_progress = false;
 			uint64_t detection_job_id = 0;
+			uint64_t rejected_submissions = 0;
 			while (!want_to_stop)
 			{
-				cv::Mat frame(frame_source->GetNextFrame());
-				
-				if (frame.empty())
+				bool replacing_overdue = false;
+				if (detection_in_progress)
 				{
-					log.error("Got an empty frame. Will retry.");
-					Poco::Thread::sleep(1000);
-					break;
+					//With no window to keep drawing there is nothing to do but wait for the detector.
+					if (TakeCompletedDetection(detection_job_id, detection_result, isInteractive ? 0 : 100))
+					{
+						//A job superseded or cancelled by someone else leaves nothing new to report.
+						is_new_detection = detection_result.status == Detector::DetectionResult::Status::Completed ||
+							detection_result.status == Detector::DetectionResult::Status::Failed;
+						detection_in_progress = false;
+					}
+					else if (detector.IsDetectionJobOverdue(detection_job_id))
+					{
+						//Still queued a whole period later. A fresher frame submitted below supersedes it.
+						replacing_overdue = true;
+						detection_in_progress = false;
+					}
+					else if (!isInteractive)
+					{
+						continue;
+					}
 				}
 
-				if (!detection_in_progress)
+				if (!quality_ladder.empty())
 				{
+					size_t rung = quality.CurrentRung(src_name);
+					if (rung != quality_rung) ApplyQualityRung(rung);
+				}
+
+				const bool detection_due = !detection_in_progress && !is_new_detection &&
+					detection_timer.elapsed() >= cam_detect_period_us;
+				const bool frame_needed = isInteractive || detection_due || !frame_source->DecodesOnDemand();
+				if (!frame_needed && !is_new_detection)
+				{
+					//Nothing to detect or report yet, and asking for a frame would only decode one for nothing.
+					Poco::Thread::sleep((long)std::clamp((cam_detect_period_us - detection_timer.elapsed()) / 1000, (int64_t)1, (int64_t)100));
+					continue;
+				}
 
-					//TODO in CPU mode this sucks down all the time. Since it is a stdlib thread there is no way to set priority
-					//TODO I think you are screwed without priority in CPU mode. I think this is why you used the frame rate limited video source
-					//There is no POCO equivalent of futures AFAIK.
-					//I think you need to refactor to give the Detector is own Poco thread with a lower priority
-					//Then use some sort of interface to allow mutiple clients to submit jobs and then get their own
-					//results (as opposed to some other client's) back later when they are done.
-					//TODO So what does that interface look like? A submit where you get back an ID for your job? Then you can poll for that ID
-					//being complete or not?
-					//TODO I made a couple function definitions in Detector.h. Mull those over. 
-					if (detection_timer.elapsed() >= cam_detect_period_us)
+				cv::Mat frame;
+				Poco::Timestamp frame_captured;
+				if (frame_needed)
+				{
+					frame = frame_source->GetNextFrame(frame_captured);
+					if (frame.empty())
 					{
-						detection_job_id = detector.SubmitDetectionJob(frame, src_name, confidence_threshold, nms_threshold);
-						detection_timer.update();
-						detection_in_progress = true;
+						log.error("Got an empty frame. Will retry.");
+						Poco::Thread::sleep(1000);
+						break;
 					}
 				}
-				else
-				{	
-					auto possible_detection = detector.GetDetectionJobIfComplete(detection_job_id);
-					if (possible_detection.has_value())
+
+				if (detection_due)
+				{
+					detection_timer.update();
+					if (motion_gate.ShouldDetect(frame))
+					{
+						Detector::Submission submission = detector.SubmitDetectionJob(frame, frame_captured, src_name, confidence_threshold, nms_threshold,
+							[this](const uint64_t job_id, Detector::DetectionResult& result) { onDetectionComplete(job_id, result); });
+						if (submission.status == Detector::Submission::Status::Rejected)
+						{
+							//The detector is full. Try again next period, still waiting on any frame it already has.
+							if (rejected_submissions++ == 0) log.warning("Detector is overloaded, skipping frames");
+							detection_in_progress = replacing_overdue;
+						}
+						else
+						{
+							if (rejected_submissions > 0)
+							{
+								log.information("Detector accepting frames again after skipping " + std::to_string(rejected_submissions));
+								rejected_submissions = 0;
+							}
+							detection_job_id = submission.job_id;
+							detection_in_progress = true;
+						}
+					}
+					else if (replacing_overdue)
+					{
+						//Nothing has moved since, so the queued frame is as good as a fresh one.
+						detection_in_progress = true;
+					}
+					else
 					{
-						detection_result = possible_detection.value();
-						is_new_detection = true;
-						detection_in_progress = false;	
+						//Nothing moved so whatever was there last time is still there.
+						is_new_detection = !detection_result.detections.empty();
 					}
 				}
 
@@ -165,14 +303,31 @@ void SourceDetectionManager::management()
 
 				if (is_new_detection)
 				{
-					detectionEvent.notify(this, detection_result.detections);
+					Poco::Timestamp dispatch_timer;
+					if (decode_scale > 1)
+					{
+						//The window below still draws on the decoded frame, so scale a copy.
+						std::vector<Detection> source_detections = detection_result.detections;
+						for (auto& detection : source_detections)
+						{
+							cv::Rect& box = detection.bounding_box;
+							box = cv::Rect(box.x * decode_scale, box.y * decode_scale, box.width * decode_scale, box.height * decode_scale);
+						}
+						detectionEvent.notify(this, source_detections);
+					}
+					else
+					{
+						detectionEvent.notify(this, detection_result.detections);
+					}
+					dispatch_histogram.Observe(dispatch_timer.elapsed());
 					is_new_detection = false;
 				}
 
 
 				if (isInteractive)
 				{
-
+					//Frames are shared with the grabber and the detector, so draw on a copy.
+					frame = frame.clone();
 					for (auto& detection : detection_result.detections)
 					{
 						if (!detection.is_null) 
@@ -1,11 +1,14 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <map>
 
 #include <Poco/AutoPtr.h>
 #include <Poco/Logger.h>
 #include <Poco/Runnable.h>
 #include <Poco/Thread.h>
+#include <Poco/Mutex.h>
+#include <Poco/Event.h>
 #include <Poco/BasicEvent.h>
 #include <Poco/Util/ConfigurationView.h>
 
@@ -13,6 +16,8 @@
 
 #include "Detector.h"
 #include "FrameSource.h"
+#include "MotionGate.h"
+#include "QualityController.h"
 
 
 class SourceDetectionManager : public Poco::Runnable, public Poco::RefCountedObject
@@ -23,6 +28,7 @@ public:
 		Poco::AutoPtr<FrameSource> frameSource,
 		const bool showWindows, 
 		Detector& objectDetector,
+		QualityController& qualityController,
 		Poco::AutoPtr<Poco::Util::AbstractConfiguration> config);
 	virtual ~SourceDetectionManager();
 
@@ -48,7 +54,29 @@ private:
 	float nms_threshold;
 	Poco::AutoPtr<FrameSource> frame_source;
 	Detector& detector;
-
+	MotionGate motion_gate;
+	LatencyHistogram& dispatch_histogram;
+	//Detections are reported in the source's own pixels, however small it was decoded.
+	int decode_scale;
+
+	//Empty when the camera always runs at its configured size and fps.
+	QualityController& quality;
+	std::vector<QualityController::Rung> quality_ladder;
+	std::vector<Poco::SharedPtr<const ModelSpec>> ladder_models;
+	size_t quality_rung;
+	int64_t base_detect_period_us;
+	Detector::SourceProfile profile;
+	void ApplyQualityRung(const size_t rung);
+
+
+	//The detector pushes finished jobs here from its own thread, by job id. Jobs
+	//abandoned for a fresher frame may still be reported after it, so results are
+	//only ever taken by id and anything older is thrown away then.
+	Poco::Mutex mu_completed_detection;
+	Poco::Event ev_detection_complete;
+	std::map<uint64_t, Detector::DetectionResult> completed_detections;
+	void onDetectionComplete(const uint64_t job_id, Detector::DetectionResult& result);
+	bool TakeCompletedDetection(const uint64_t job_id, Detector::DetectionResult& result, const long wait_ms);
 
 	void drawPred(std::string class_name, float conf, int left, int top, int right, int bottom, cv::Mat& frame);
 
@@ -0,0 +1,331 @@
+#ifdef OD_WITH_FFMPEG
+#include "StreamClipper.h"
+
+#include <algorithm>
+
+#include <Poco/DateTime.h>
+#include <Poco/DateTimeFormatter.h>
+#include <Poco/File.h>
+#include <Poco/LocalDateTime.h>
+#include <Poco/Path.h>
+
+//A stream that delivers nothing for this long is reopened.
+static const Poco::Timestamp::TimeDiff read_timeout_us = 10000000;
+
+static std::string ErrorText(const int error)
+{
+	char text[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+	av_strerror(error, text, sizeof(text));
+	return text;
+}
+
+StreamClipper::StreamClipper(const std::string& source_name, const std::string& stream_url, const Settings& clip_settings) :
+	log(Poco::Logger::get(source_name)),
+	src_name(source_name),
+	url(stream_url),
+	settings(clip_settings),
+	input(nullptr),
+	video_stream(-1),
+	output(nullptr),
+	header_written(false),
+	clip_pending(false),
+	trigger_deferred(false),
+	first_dts(AV_NOPTS_VALUE),
+	last_dts(AV_NOPTS_VALUE),
+	clips_written(0),
+	want_to_stop(false)
+{
+}
+
+StreamClipper::~StreamClipper()
+{
+	stop();
+}
+
+void StreamClipper::start()
+{
+	want_to_stop = false;
+	if (!clip_thread.isRunning()) clip_thread.start(*this);
+}
+
+void StreamClipper::stop()
+{
+	want_to_stop = true;
+	if (clip_thread.isRunning())
+	{
+		clip_thread.join();
+		log.information("Wrote " + std::to_string(clips_written) + " clips");
+	}
+}
+
+int StreamClipper::Interrupt(void* opaque)
+{
+	StreamClipper* clipper = static_cast<StreamClipper*>(opaque);
+	return clipper->want_to_stop || clipper->last_read.isElapsed(read_timeout_us) ? 1 : 0;
+}
+
+bool StreamClipper::Open()
+{
+	AVFormatContext* context = avformat_alloc_context();
+	context->interrupt_callback.callback = &StreamClipper::Interrupt;
+	context->interrupt_callback.opaque = this;
+
+	AVDictionary* options = nullptr;
+	if (url.compare(0, 7, "rtsp://") == 0) av_dict_set(&options, "rtsp_transport", settings.rtsp_transport.c_str(), 0);
+	last_read.update();
+	//Frees the context when it fails.
+	int result = avformat_open_input(&context, url.c_str(), nullptr, &options);
+	av_dict_free(&options);
+	if (result < 0)
+	{
+		log.error("Could not open the stream for clips: " + ErrorText(result));
+		return false;
+	}
+
+	last_read.update();
+	result = avformat_find_stream_info(context, nullptr);
+	const int stream = result < 0 ? result : av_find_best_stream(context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (stream < 0)
+	{
+		log.error("No video found in the stream for clips: " + ErrorText(stream));
+		avformat_close_input(&context);
+		return false;
+	}
+
+	{
+		Poco::ScopedLock<Poco::Mutex> locker(mu_clip);
+		input = context;
+		video_stream = stream;
+	}
+	log.information(std::string("Buffering ") + avcodec_get_name(context->streams[stream]->codecpar->codec_id) + " packets for clips");
+	return true;
+}
+
+void StreamClipper::Close()
+{
+	AVFormatContext* context;
+	{
+		Poco::ScopedLock<Poco::Mutex> locker(mu_clip);
+		CloseClip();
+		clip_pending = false;
+		trigger_deferred = false;
+		ClearBuffer();
+		context = input;
+		input = nullptr;
+		video_stream = -1;
+	}
+	if (context != nullptr) avformat_close_input(&context);
+}
+
+void StreamClipper::run()
+{
+	while (!want_to_stop)
+	{
+		if (input == nullptr && !Open())
+		{
+			for (int waited = 0; waited < 50 && !want_to_stop; ++waited) Poco::Thread::sleep(100);
+			continue;
+		}
+
+		AVPacket* packet = av_packet_alloc();
+		last_read.update();
+		int result = av_read_frame(input, packet);
+		if (result < 0)
+		{
+			av_packet_free(&packet);
+			if (!want_to_stop) log.warning("Lost the stream for clips, reopening: " + ErrorText(result));
+			Close();
+			continue;
+		}
+		if (packet->stream_index != video_stream)
+		{
+			av_packet_free(&packet);
+			continue;
+		}
+
+		const Poco::Timestamp arrived;
+		Poco::ScopedLock<Poco::Mutex> locker(mu_clip);
+		const bool recording = output != nullptr;
+		Buffer(packet, arrived);
+		if (recording) WritePacket(packet);
+		else if (clip_pending) TryOpenClip();
+
+		if (output != nullptr && arrived > clip_end)
+		{
+			CloseClip();
+			if (trigger_deferred)
+			{
+				trigger_deferred = false;
+				StartClip(deferred_at);
+			}
+		}
+		if (clip_pending && arrived > clip_end)
+		{
+			clip_pending = false;
+			log.warning("No key frame arrived before the clip would have ended, dropped it");
+		}
+	}
+	Close();
+}
+
+void StreamClipper::Buffer(AVPacket* packet, const Poco::Timestamp& arrived)
+{
+	buffered.push_back({ packet, arrived });
+
+	//Keep back to the newest key frame that is at least pre old, so any clip
+	//can start on a key frame that far back.
+	const Poco::Timestamp cutoff = arrived - settings.pre_us;
+	size_t keep_from = 0;
+	for (size_t index = 1; index < buffered.size() && buffered[index].arrived <= cutoff; ++index)
+	{
+		if (buffered[index].packet->flags & AV_PKT_FLAG_KEY) keep_from = index;
+	}
+	for (size_t index = 0; index < keep_from; ++index)
+	{
+		av_packet_free(&buffered.front().packet);
+		buffered.pop_front();
+	}
+}
+
+void StreamClipper::ClearBuffer()
+{
+	for (auto& item : buffered) av_packet_free(&item.packet);
+	buffered.clear();
+}
+
+void StreamClipper::Trigger(const Poco::Timestamp& at)
+{
+	Poco::ScopedLock<Poco::Mutex> locker(mu_clip);
+	const Poco::Timestamp end = at + settings.post_us;
+	if (output != nullptr)
+	{
+		clip_end = std::max(clip_end, end);
+		CapClip(clip_opened + settings.max_us);
+		return;
+	}
+	if (clip_pending)
+	{
+		clip_end = std::max(clip_end, end);
+		return;
+	}
+	StartClip(at);
+}
+
+void StreamClipper::StartClip(const Poco::Timestamp& at)
+{
+	clip_pending = true;
+	pending_from = at - settings.pre_us;
+	clip_end = at + settings.post_us;
+	TryOpenClip();
+}
+
+void StreamClipper::CapClip(const Poco::Timestamp& cap)
+{
+	if (clip_end <= cap) return;
+	//Only the latest trigger matters, the next clip runs post past it.
+	const Poco::Timestamp at = clip_end - settings.post_us;
+	if (!trigger_deferred || at > deferred_at) deferred_at = at;
+	trigger_deferred = true;
+	clip_end = cap;
+}
+
+void StreamClipper::TryOpenClip()
+{
+	if (input == nullptr) return;
+
+	//The newest key frame at or before the start, or failing that the oldest one buffered.
+	auto start = buffered.end();
+	for (auto it = buffered.begin(); it != buffered.end(); ++it)
+	{
+		if (!(it->packet->flags & AV_PKT_FLAG_KEY)) continue;
+		if (start == buffered.end() || it->arrived <= pending_from) start = it;
+	}
+	if (start == buffered.end()) return;
+	clip_pending = false;
+
+	const std::string name = src_name + "_" + Poco::DateTimeFormatter::format(Poco::LocalDateTime(Poco::DateTime(start->arrived)), "%Y%m%d_%H%M%S");
+	Poco::Path path(settings.directory);
+	path.append(name + ".mp4");
+	//A clip started as another finishes can begin on the same key frame.
+	for (int sequence = 2; Poco::File(path).exists(); ++sequence) path.setFileName(name + "_" + std::to_string(sequence) + ".mp4");
+	clip_path = path.toString();
+
+	int result = avformat_alloc_output_context2(&output, nullptr, "mp4", clip_path.c_str());
+	if (result < 0)
+	{
+		output = nullptr;
+		log.error("Could not create clip " + clip_path + ": " + ErrorText(result));
+		return;
+	}
+	AVStream* stream = avformat_new_stream(output, nullptr);
+	result = stream == nullptr ? AVERROR(ENOMEM) : avcodec_parameters_copy(stream->codecpar, input->streams[video_stream]->codecpar);
+	if (result >= 0)
+	{
+		//Let the MP4 muxer pick its own tag for the codec.
+		stream->codecpar->codec_tag = 0;
+		stream->time_base = input->streams[video_stream]->time_base;
+		result = avio_open(&output->pb, clip_path.c_str(), AVIO_FLAG_WRITE);
+	}
+	if (result >= 0) result = avformat_write_header(output, nullptr);
+	if (result < 0)
+	{
+		log.error("Could not start clip " + clip_path + ": " + ErrorText(result));
+		CloseClip();
+		return;
+	}
+	header_written = true;
+	clip_opened.update();
+	CapClip(clip_opened + settings.max_us);
+	log.information("Recording clip " + clip_path);
+
+	for (auto it = start; it != buffered.end() && output != nullptr; ++it) WritePacket(it->packet);
+}
+
+void StreamClipper::WritePacket(const AVPacket* source)
+{
+	AVPacket* packet = av_packet_clone(source);
+	if (packet == nullptr) return;
+	if (packet->dts == AV_NOPTS_VALUE) packet->dts = packet->pts;
+	if (packet->pts == AV_NOPTS_VALUE) packet->pts = packet->dts;
+	//MP4 needs every packet's decode time, always increasing.
+	if (packet->dts == AV_NOPTS_VALUE || (last_dts != AV_NOPTS_VALUE && packet->dts - first_dts <= last_dts))
+	{
+		av_packet_free(&packet);
+		return;
+	}
+
+	//The clip starts at time zero.
+	if (first_dts == AV_NOPTS_VALUE) first_dts = packet->dts;
+	packet->dts -= first_dts;
+	packet->pts -= first_dts;
+	last_dts = packet->dts;
+	packet->stream_index = 0;
+	packet->pos = -1;
+	av_packet_rescale_ts(packet, input->streams[video_stream]->time_base, output->streams[0]->time_base);
+
+	const int result = av_interleaved_write_frame(output, packet);
+	av_packet_free(&packet);
+	if (result < 0)
+	{
+		log.error("Could not write to clip " + clip_path + ": " + ErrorText(result));
+		CloseClip();
+	}
+}
+
+void StreamClipper::CloseClip()
+{
+	if (output == nullptr) return;
+	if (header_written)
+	{
+		av_write_trailer(output);
+		++clips_written;
+		log.information("Finished clip " + clip_path);
+	}
+	if (output->pb != nullptr) avio_closep(&output->pb);
+	avformat_free_context(output);
+	output = nullptr;
+	header_written = false;
+	first_dts = AV_NOPTS_VALUE;
+	last_dts = AV_NOPTS_VALUE;
+}
+#endif
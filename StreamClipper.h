@@ -0,0 +1,99 @@
+#pragma once
+#ifdef OD_WITH_FFMPEG
+#include <string>
+#include <deque>
+#include <cinttypes>
+
+#include <Poco/Logger.h>
+#include <Poco/Mutex.h>
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
+#include <Poco/Timestamp.h>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+//Cuts MP4 clips out of a camera's compressed stream without decoding it.
+//OpenCV's capture never hands out the packets it reads, so the stream is
+//opened a second time through libavformat on a thread of its own. The video
+//packets of the last pre seconds are kept, back to the key frame before them.
+//A trigger starts a clip at the buffered key frame nearest pre seconds before
+//it, and the clip runs until post seconds past the latest trigger, so events
+//that overlap extend one clip instead of starting another. A trigger that
+//would run a clip past max seconds starts the next clip once it closes.
+//Packets are copied into the file as they are.
+class StreamClipper : public Poco::Runnable
+{
+public:
+	struct Settings
+	{
+		std::string directory;
+		Poco::Timestamp::TimeDiff pre_us;
+		Poco::Timestamp::TimeDiff post_us;
+		//No clip runs longer than this however often it is extended.
+		Poco::Timestamp::TimeDiff max_us;
+		std::string rtsp_transport;
+	};
+
+	StreamClipper(const std::string& source_name, const std::string& stream_url, const Settings& clip_settings);
+	~StreamClipper();
+
+	void start();
+	void run() override;
+	void stop();
+
+	//Any thread. Records from pre before the moment to post after it, or extends the open clip.
+	void Trigger(const Poco::Timestamp& at);
+
+	uint64_t ClipsWritten() const { return clips_written; }
+
+private:
+	Poco::Logger& log;
+	std::string src_name;
+	std::string url;
+	Settings settings;
+
+	//Only the clipper's thread reads the stream. Guarded by mu_clip when changed.
+	AVFormatContext* input;
+	int video_stream;
+	Poco::Timestamp last_read;
+	bool Open();
+	void Close();
+	static int Interrupt(void* opaque);
+
+	struct BufferedPacket
+	{
+		AVPacket* packet;
+		Poco::Timestamp arrived;
+	};
+	Poco::Mutex mu_clip;
+	std::deque<BufferedPacket> buffered;
+	void Buffer(AVPacket* packet, const Poco::Timestamp& arrived);
+	void ClearBuffer();
+
+	AVFormatContext* output;
+	bool header_written;
+	std::string clip_path;
+	Poco::Timestamp clip_opened;
+	Poco::Timestamp clip_end;
+	//Triggered before a key frame was buffered to start from.
+	bool clip_pending;
+	Poco::Timestamp pending_from;
+	//The latest trigger cut short by max_us, started as a clip of its own once the open one closes.
+	bool trigger_deferred;
+	Poco::Timestamp deferred_at;
+	int64_t first_dts;
+	int64_t last_dts;
+	uint64_t clips_written;
+	void StartClip(const Poco::Timestamp& at);
+	void TryOpenClip();
+	void CapClip(const Poco::Timestamp& cap);
+	void WritePacket(const AVPacket* source);
+	void CloseClip();
+
+	volatile bool want_to_stop;
+	Poco::Thread clip_thread;
+};
+#endif
@@ -1,8 +1,15 @@
 #include "ThreadedDetectionProcessor.h"
 
+#include <Poco/Timestamp.h>
+
 using namespace Poco;
 using namespace std;
 
+ThreadedDetectionProcessor::ThreadedDetectionProcessor(const std::string& processor_name) :
+	process_histogram(Metrics::instance().Histogram("od_emit_seconds", "Time an emitter spends sending one set of detections", "emitter", processor_name))
+{
+}
+
 ThreadedDetectionProcessor::~ThreadedDetectionProcessor()
 {
 	stop();
@@ -29,7 +36,9 @@ void ThreadedDetectionProcessor::run()
 		{
 			ScopedLock<Mutex> locker(mu_detection_queue);
 			auto detection = detection_queue.front();
+			Timestamp process_timer;
 			processDetection(detection);
+			process_histogram.Observe(process_timer.elapsed());
 			detection_queue.pop();
 		}
 	}
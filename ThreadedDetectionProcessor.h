@@ -9,9 +9,13 @@
 #include <Poco/BasicEvent.h>
 
 #include "Detection.h"
+#include "Metrics.h"
+
 class ThreadedDetectionProcessor : public Poco::Runnable
 {
 public:
+	//The name labels the processor's metrics.
+	ThreadedDetectionProcessor(const std::string& processor_name);
 	virtual ~ThreadedDetectionProcessor();
 
 	void onDetection(const void* sender, std::vector<Detection>& detections);
@@ -28,5 +32,6 @@ private:
 	Poco::Event evt_detection_queue;
 	volatile bool want_to_stop = false;
 	Poco::Thread processor_thread;
+	LatencyHistogram& process_histogram;
 };
 
@@ -0,0 +1,89 @@
+#include "TileLayout.h"
+
+#include <Poco/Exception.h>
+#include <Poco/NumberParser.h>
+#include <Poco/StringTokenizer.h>
+
+#include <algorithm>
+#include <cmath>
+
+
+void TileLayout::Plan(const cv::Size frame_size, std::vector<cv::Rect>& tiles) const
+{
+	tiles.clear();
+	const cv::Rect frame_rect(cv::Point(0, 0), frame_size);
+
+	cv::Rect roi_rect = frame_rect;
+	if (!roi.empty())
+	{
+		roi_rect = cv::Rect(
+			(int)std::floor(roi.x * frame_size.width),
+			(int)std::floor(roi.y * frame_size.height),
+			(int)std::ceil(roi.width * frame_size.width),
+			(int)std::ceil(roi.height * frame_size.height)) & frame_rect;
+		if (roi_rect.empty()) roi_rect = frame_rect;
+	}
+
+	if (columns <= 1 && rows <= 1)
+	{
+		tiles.push_back(roi_rect);
+		return;
+	}
+
+	//The grid always covers the whole frame so tile boundaries do not move when the region of interest changes.
+	auto span = [this](const int length, const int count, int& tile_length, double& step)
+	{
+		tile_length = (int)std::ceil(length / (count - (count - 1) * (double)overlap));
+		tile_length = std::min(tile_length, length);
+		step = count > 1 ? (double)(length - tile_length) / (count - 1) : 0.0;
+	};
+
+	const int cols = std::max(columns, 1);
+	const int rws = std::max(rows, 1);
+	int tile_w, tile_h;
+	double step_x, step_y;
+	span(frame_size.width, cols, tile_w, step_x);
+	span(frame_size.height, rws, tile_h, step_y);
+
+	for (int r = 0; r < rws; ++r)
+	{
+		for (int c = 0; c < cols; ++c)
+		{
+			cv::Rect tile((int)std::lround(c * step_x), (int)std::lround(r * step_y), tile_w, tile_h);
+			tile &= frame_rect;
+			if ((tile & roi_rect).empty()) continue;
+			tiles.push_back(tile);
+		}
+	}
+
+	if (tiles.empty()) tiles.push_back(roi_rect);
+}
+
+TileLayout TileLayout::FromConfig(const Poco::Util::AbstractConfiguration& config)
+{
+	TileLayout layout;
+	layout.columns = std::max(config.getInt("tiles.columns", 1), 1);
+	layout.rows = std::max(config.getInt("tiles.rows", 1), 1);
+	layout.overlap = (float)std::min(std::max(config.getDouble("tiles.overlap", 0.2), 0.0), 0.9);
+
+	if (config.has("roi"))
+	{
+		Poco::StringTokenizer tokenizer(config.getString("roi"), ",", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+		if (tokenizer.count() != 4)
+		{
+			throw Poco::SyntaxException("roi must be left,top,width,height as fractions of the frame");
+		}
+		cv::Rect2f roi(
+			(float)Poco::NumberParser::parseFloat(tokenizer[0]),
+			(float)Poco::NumberParser::parseFloat(tokenizer[1]),
+			(float)Poco::NumberParser::parseFloat(tokenizer[2]),
+			(float)Poco::NumberParser::parseFloat(tokenizer[3]));
+		layout.roi = roi & cv::Rect2f(0.0f, 0.0f, 1.0f, 1.0f);
+		if (layout.roi.empty())
+		{
+			throw Poco::SyntaxException("roi does not cover any of the frame");
+		}
+	}
+
+	return layout;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <Poco/Util/AbstractConfiguration.h>
+
+//How a camera's frames are cut up before detection. A high resolution frame
+//squashed down to the network input loses small and distant objects, so the
+//frame is instead split into a grid of overlapping tiles, each of which gets
+//the full network input to itself. Tiles that miss the region of interest
+//are never run. A 1x1 grid with a region of interest just crops the frame.
+struct TileLayout
+{
+	int columns = 1;
+	int rows = 1;
+	//Fraction of a tile shared with its neighbour, so objects on a seam are whole in at least one tile.
+	float overlap = 0.2f;
+	//Normalized to the frame (0-1). Empty means the whole frame.
+	cv::Rect2f roi;
+
+	inline bool IsTiled() const { return columns * rows > 1; }
+
+	//Fills tiles with the frame regions to run. Always yields at least one.
+	void Plan(const cv::Size frame_size, std::vector<cv::Rect>& tiles) const;
+
+	//Reads tiles.columns, tiles.rows, tiles.overlap and roi (left,top,width,height as fractions of the frame).
+	static TileLayout FromConfig(const Poco::Util::AbstractConfiguration& config);
+};
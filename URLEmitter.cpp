@@ -27,6 +27,7 @@ using namespace Poco;
 using namespace Poco::Net;
 
 URLEmitter::URLEmitter(const std::string& emitter_name, const std::string& url, const std::string& username, const std::string& password, const bool log_detections):
+	ThreadedDetectionProcessor(emitter_name),
 	name(emitter_name),
 	theUrl(url),
 	user(username),
@@ -0,0 +1,109 @@
+#include "YoloDecoder.h"
+
+#include <opencv2/core.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define YOLO_DECODER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define YOLO_DECODER_SSE2
+#endif
+
+
+void YoloDecoder::AddCandidate(const float* row, const float confidence, const int class_id, const BoxMapping& mapping, DetectionCandidates& candidates)
+{
+	int centerX = (int)(row[0] * mapping.scale_x + mapping.offset_x);
+	int centerY = (int)(row[1] * mapping.scale_y + mapping.offset_y);
+	int width = (int)(row[2] * mapping.scale_x);
+	int height = (int)(row[3] * mapping.scale_y);
+	candidates.push_back(centerX - width / 2, centerY - height / 2, width, height, confidence, class_id);
+}
+
+void YoloDecoder::DecodeScalar(const float* rows, const int num_rows, const int row_width, const float confidence_threshold,
+	const BoxMapping& mapping, DetectionCandidates& candidates, const bool scale_by_objectness)
+{
+	//A row without at least one class score means the output layout is wrong for the model.
+	CV_Assert(row_width > 5);
+	const int num_classes = row_width - 5;
+	const float* row = rows;
+	for (int j = 0; j < num_rows; ++j, row += row_width)
+	{
+		const float objectness = row[4];
+		if (!(objectness > confidence_threshold)) continue;
+
+		const float* scores = row + 5;
+		int class_id = 0;
+		float best = scores[0];
+		for (int c = 1; c < num_classes; ++c)
+		{
+			if (scores[c] > best)
+			{
+				best = scores[c];
+				class_id = c;
+			}
+		}
+
+		float confidence = scale_by_objectness ? best * objectness : best;
+		if (confidence > confidence_threshold) AddCandidate(row, confidence, class_id, mapping, candidates);
+	}
+}
+
+#if defined(YOLO_DECODER_AVX2) || defined(YOLO_DECODER_SSE2)
+
+void YoloDecoder::Decode(const float* rows, const int num_rows, const int row_width, const float confidence_threshold,
+	const BoxMapping& mapping, DetectionCandidates& candidates, const bool scale_by_objectness)
+{
+	//A row without at least one class score means the output layout is wrong for the model.
+	CV_Assert(row_width > 5);
+	const int num_classes = row_width - 5;
+	const float* row = rows;
+	for (int j = 0; j < num_rows; ++j, row += row_width)
+	{
+		const float objectness = row[4];
+		if (!(objectness > confidence_threshold)) continue;
+
+		//Find the best score with wide max operations, then go back for its
+		//first position, which is the same class minMaxLoc would report.
+		const float* scores = row + 5;
+		int c = 0;
+#if defined(YOLO_DECODER_AVX2)
+		__m256 wide_best = _mm256_set1_ps(scores[0]);
+		for (; c + 8 <= num_classes; c += 8)
+		{
+			wide_best = _mm256_max_ps(wide_best, _mm256_loadu_ps(scores + c));
+		}
+		__m128 vbest = _mm_max_ps(_mm256_castps256_ps128(wide_best), _mm256_extractf128_ps(wide_best, 1));
+#else
+		__m128 vbest = _mm_set1_ps(scores[0]);
+		for (; c + 4 <= num_classes; c += 4)
+		{
+			vbest = _mm_max_ps(vbest, _mm_loadu_ps(scores + c));
+		}
+#endif
+		vbest = _mm_max_ps(vbest, _mm_movehl_ps(vbest, vbest));
+		vbest = _mm_max_ss(vbest, _mm_shuffle_ps(vbest, vbest, 1));
+		float best = _mm_cvtss_f32(vbest);
+		for (; c < num_classes; ++c)
+		{
+			if (scores[c] > best) best = scores[c];
+		}
+
+		float confidence = scale_by_objectness ? best * objectness : best;
+		if (!(confidence > confidence_threshold)) continue;
+
+		int class_id = 0;
+		while (scores[class_id] != best) ++class_id;
+		AddCandidate(row, confidence, class_id, mapping, candidates);
+	}
+}
+
+#else
+
+void YoloDecoder::Decode(const float* rows, const int num_rows, const int row_width, const float confidence_threshold,
+	const BoxMapping& mapping, DetectionCandidates& candidates, const bool scale_by_objectness)
+{
+	DecodeScalar(rows, num_rows, row_width, confidence_threshold, mapping, candidates, scale_by_objectness);
+}
+
+#endif
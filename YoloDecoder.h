@@ -0,0 +1,38 @@
+#pragma once
+#include "DetectionCandidates.h"
+
+//Maps a box in normalized network coordinates onto frame pixels:
+//pixel = normalized * scale + offset
+struct BoxMapping
+{
+	float scale_x;
+	float scale_y;
+	float offset_x;
+	float offset_y;
+};
+
+//Turns the rows produced by a YOLO region layer (cx, cy, w, h, objectness,
+//class scores...) into candidate boxes.
+//
+//Class scores never exceed the objectness once they are multiplied by it, so a
+//row whose objectness does not clear the threshold is rejected without looking
+//at its class scores. That is the fate of nearly every row. For the rest, the
+//class argmax, the objectness multiply and the threshold test are one pass.
+//OpenCV's region layer has already folded the objectness into the class scores
+//so Darknet outputs are decoded with scale_by_objectness = false.
+//
+//Rows must hold at least one class score. Anything narrower throws, since it
+//means the output layout configured does not match the model.
+class YoloDecoder
+{
+public:
+	static void Decode(const float* rows, const int num_rows, const int row_width, const float confidence_threshold,
+		const BoxMapping& mapping, DetectionCandidates& candidates, const bool scale_by_objectness = false);
+
+	//Plain C++ version of the above. Used on CPUs without SSE2 and as a reference.
+	static void DecodeScalar(const float* rows, const int num_rows, const int row_width, const float confidence_threshold,
+		const BoxMapping& mapping, DetectionCandidates& candidates, const bool scale_by_objectness = false);
+
+private:
+	static void AddCandidate(const float* row, const float confidence, const int class_id, const BoxMapping& mapping, DetectionCandidates& candidates);
+};